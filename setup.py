@@ -3,18 +3,31 @@ import numpy
 
 __version__ = "1.1.2"
 
+# OpenMP is used to build and search the k-d trees in parallel
+openmp_args = ['-fopenmp']
+
 # define the extension module
 extensions = []
 extensions.append(Extension('_sstmap_ext',
                             sources=['sstmap/_sstmap_ext.c'],
+                            depends=['sstmap/vptree.h', 'sstmap/waterorient.h'],
                             include_dirs=[numpy.get_include()],
                             extra_link_args=['-lgsl','-lgslcblas']))
 extensions.append(Extension('_sstmap_entropy',
-                            sources=['sstmap/_sstmap_entropy.cpp', 'sstmap/kdhsa102.cpp'],
+                            sources=['sstmap/_sstmap_entropy.cpp'],
+                            depends=['sstmap/kdtree.h', 'sstmap/kdtree_simd.h', 'sstmap/waterorient.h',
+                                     'sstmap/pdbcoords.h', 'sstmap/vptree.h'],
+                            include_dirs=[numpy.get_include()],
+                            extra_compile_args=openmp_args,
+                            extra_link_args=openmp_args,
                             language="c++"))
 
 extensions.append(Extension('_sstmap_probableconfig',
-                            sources=['sstmap/_sstmap_probable.cpp', 'sstmap/probable.cpp'],
+                            sources=['sstmap/_sstmap_probable.cpp'],
+                            depends=['sstmap/kdtree.h', 'sstmap/kdtree_simd.h', 'sstmap/waterorient.h',
+                                     'sstmap/pdbcoords.h'],
+                            extra_compile_args=openmp_args,
+                            extra_link_args=openmp_args,
                             language="c++"))
 
 setup(name='sstmap',
@@ -4,11 +4,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <vector>
+#include <new>
+#include <exception>
 #include <math.h>
-#include "kdhsa102.h"
+#include "kdtree.h"
+#include "waterorient.h"
+#include "pdbcoords.h"
+#include "vptree.h"
 //#include "6dimprobable.h"
 #include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include "numpy/arrayobject.h"
 
 using namespace std;
 
@@ -67,37 +75,19 @@ void bruteclust(string cfile, string wfile) {
         << "within5Aofligand contains all coordinates of waters within a certain distance of the ligand\n\n";
         exit(0);
     }    
-    vector<double > cens;
-    vector<double > wats;
-
-    string temp;
-    ifstream cinput(cfile.c_str());
-    getline(cinput, temp); //skip header
-    while (!cinput.eof()) {
-        getline(cinput, temp);
-        if (!temp.empty()) {
-            cens.push_back(atof(temp.substr(31, 7).c_str()));
-            cens.push_back(atof(temp.substr(39, 7).c_str()));
-            cens.push_back(atof(temp.substr(47, 7).c_str()));
-        }
-    }
-    
-    cinput.close();
-
+    vector<double> cens = pdbread(cfile, true);
     int numclust = cens.size()/3;
-
-    ifstream winput(wfile.c_str());
-    getline(winput, temp); //skip header
-    while (!winput.eof()) {
-        getline(winput, temp);
-        if (!temp.empty()) {
-            wats.push_back(atof(temp.substr(31, 7).c_str()));
-            wats.push_back(atof(temp.substr(39, 7).c_str()));
-            wats.push_back(atof(temp.substr(47, 7).c_str()));
-        }
-    }
-
-    winput.close();
+    //the clusters are written as water containers, with the frames of their waters, when wfile is one
+    pdbcoords win(wfile, true);
+    vector<double> wats = win.coords();
+    const int32_t *frames = win.frames();
+    vector<double> clwats;
+    vector<int> clframes;
+
+    //tree of the oxygens, it narrows down the waters that have to be compared with each cluster center
+    kdtree<3> otree(pdboxygens(wats));
+    vector<int> near;
+    point<3> cen;
 
     FILE* pFile;
     char fileName[80];
@@ -108,23 +98,25 @@ void bruteclust(string cfile, string wfile) {
     //stringstream ss;
     //cout << "cencount" << cencount << endl;
     int j = 0;
-    for (int i = 0; i <= numclust; i++) {
+    for (int i = 0; i < numclust; i++) {
         val = i+1;
         //cout << val << endl;
         if (i < 9) {
-            sprintf(fileName, "cluster.00000%i.pdb", val);
+            sprintf(fileName, "cluster.00000%i.%s", val, win.binary ? "wat" : "pdb");
             //ss << "cluster.00000" << val << ".pdb";
             //ss >> fileName;
         }
         else if (i < 99){
-            sprintf(fileName, "cluster.0000%i.pdb", val);
+            sprintf(fileName, "cluster.0000%i.%s", val, win.binary ? "wat" : "pdb");
             //ss << "cluster.0000" << val << ".pdb";
             //ss >> fileName;
         }
     else {
-        sprintf(fileName, "cluster.000%i.pdb", val);
+        sprintf(fileName, "cluster.000%i.%s", val, win.binary ? "wat" : "pdb");
     }
-        pFile = fopen(fileName, "w");
+        pFile = win.binary ? NULL : fopen(fileName, "w");
+        clwats.clear();
+        clframes.clear();
         pos = 0;
         /*for (int j = 0; j < watnum; j++) {
             if (wats[j].numclust != 0) {
@@ -147,9 +139,18 @@ void bruteclust(string cfile, string wfile) {
 
         //for (int j = 0; j < cens.size(); j+=3) {
         j = i*3;
-            for (int k = 0; k < wats.size(); k+=9) {
+        //a hair wider than the cutoff so that the test below alone decides, the waters are written in input order
+        cen.set_point(&cens[j]);
+        otree.locatenear(cen, 2.0*(1 + 1e-9), near);
+        sort(near.begin(), near.end());
+            for (int n = 0; n < near.size(); n++) {
+                int k = 9*near[n];
                 dist = pow((cens[j] - wats[k]), 2) + pow((cens[j+1] - wats[k+1]), 2) + pow((cens[j+2] - wats[k+2]), 2);
-                if (dist <= 4) {
+                if (dist <= 4 && win.binary) {
+                    clwats.insert(clwats.end(), wats.begin() + k, wats.begin() + k + 9);
+                    if (frames) clframes.push_back(frames[near[n]]);
+                }
+                else if (dist <= 4) {
                     atom = "O";
                     fprintf (pFile, "%-6s%5i %-4s %3s %1s%4i    %8.3f%8.3f%8.3f%6.2f%6.2f\n", name.c_str(), pos, atom.c_str(), resname.c_str(), chainid.c_str(), resseq, wats[k], wats[k+1], wats[k+2], occupancy, T);
                     pos++;
@@ -162,12 +163,447 @@ void bruteclust(string cfile, string wfile) {
             }
         //}
 
-        fclose(pFile);
+        if (win.binary) waterwrite(fileName, clwats, frames ? &clframes : NULL);
+        else fclose(pFile);
+    }
+}
+
+
+template <typename Scalar>
+kdtree<3, Scalar> *transtree(const pdbcoords &pdb, string treefile, const double *origin) {
+    /*
+        Translational tree of the expanded cluster file pdb, coordinates taken relative to origin. Given a treefile
+        the tree is saved there, tagged with a checksum of the expanded file, and on later runs mapped back from it
+        instead of rebuilt for as long as the expanded file is unchanged.
+    */
+    unsigned long long sum = 0;
+    if (!treefile.empty()) {
+        sum = kdchecksum(pdb.data, pdb.len);
+        try {
+            kdtree<3, Scalar> *cached = new kdtree<3, Scalar>(treefile);
+            if (cached->tag == sum) return cached;
+            delete cached;
+        }
+        catch (const char *err) {} //no usable tree yet, built below
+    }
+    vector<double> oxygens = pdboxygens(pdb.coords());
+    vector<Scalar> tmp2(oxygens.size());
+    for (int i = 0; i < oxygens.size(); i++) tmp2[i] = oxygens[i] - origin[i%3];
+    kdtree<3, Scalar> *trans = new kdtree<3, Scalar>(tmp2);
+    if (!treefile.empty()) {
+        trans->tag = sum;
+        try {
+            trans->save(treefile);
+        }
+        catch (const char *err) {
+            cerr << err << ": " << treefile << endl;
+        }
+    }
+    return trans;
+}
+
+template <typename Scalar>
+vector<double> transentropy(string expfile, string treefile, const vector<double> &cls, double eps, int kmax) {
+    /*
+        Translational entropies of the oxygens cls of the standard cluster from their k = 1..kmax nearest
+        neighbours, one per k. In single precision every coordinate is
+        taken relative to the first oxygen of the expanded cluster, neighbours a few angstrom apart then keep all
+        the digits of a float instead of losing them to the distance from the origin of the system.
+    */
+    pdbcoords pdb(expfile, false);
+    double origin[3] = {0, 0, 0};
+    if (sizeof(Scalar) < sizeof(double)) pdb.front(origin);
+    kdtree<3, Scalar> *trans = transtree<Scalar>(pdb, treefile, origin);
+    vector<Scalar> q(cls.size());
+    for (int i = 0; i < cls.size(); i++) q[i] = cls[i] - origin[i%3];
+    trans->setepsilon(eps);
+    vector<double> s(kmax);
+    trans->run_tree_trans(q, kmax, &s[0]);
+    delete trans;
+    return s;
+}
+
+template <typename Scalar>
+vector<double> transentropy(const vector<double> &expwaters, const vector<double> &cls, double eps, int kmax,
+                            double *dist = NULL, double *logterm = NULL) {
+    /*
+        As above with the expanded cluster waters (9 doubles a water) in memory, the tree is built every time.
+        dist and logterm if given receive the neighbour distances and log terms of each oxygen, kmax a water.
+    */
+    double origin[3] = {0, 0, 0};
+    if (sizeof(Scalar) < sizeof(double) && expwaters.size() >= 3) {
+        for (int i = 0; i < 3; i++) origin[i] = expwaters[i];
+    }
+    vector<Scalar> oxygens;
+    oxygens.reserve(expwaters.size()/3);
+    for (int i = 0; i < expwaters.size(); i++) {
+        if (i%9 == 0 || i%9 == 1 || i%9 == 2) oxygens.push_back(expwaters[i] - origin[i%3]);
+    }
+    kdtree<3, Scalar> trans(oxygens);
+    vector<Scalar> q(cls.size());
+    for (int i = 0; i < cls.size(); i++) q[i] = cls[i] - origin[i%3];
+    trans.setepsilon(eps);
+    vector<double> s(kmax);
+    trans.run_tree_trans(q, kmax, &s[0], dist, logterm);
+    return s;
+}
+
+template <typename Scalar>
+vector<double> oriententropy(const vector<double> &euler, double eps, int kmax, double *dist = NULL,
+                             double *logterm = NULL) {
+    //orientational entropies of the Euler angles (sin(theta), phi, psi) of the standard cluster, one per k = 1..kmax
+    double pi = 3.14159265359;
+    vector<Scalar> vals(euler.begin(), euler.end());
+    kdtree<3, Scalar> orient(vals);
+    orient.setperiod(1, 2*pi); //phi and psi wrap around, sin(theta) does not
+    orient.setperiod(2, 2*pi);
+    orient.setepsilon(eps);
+    vector<double> s(kmax);
+    orient.run_tree_orient(kmax, &s[0], dist, logterm);
+    return s;
+}
+
+vector<double> eulerangles(const vector<double> &waters) {
+    //Euler angles (sin(theta), phi, psi) of the waters (O, H1, H2 positions, 9 doubles a water), three doubles a water
+    vector<double> euler(waters.size()/3);
+    if (!euler.empty()) waterorient(&waters[0], waters.size()/9, NULL, &euler[0]);
+    return euler;
+}
+
+void probableconfig(const vector<double> &waters, const vector<double> &euler, double *conf) {
+    /*
+        Most probable configuration of a site as prob of _sstmap_probable.cpp picks it, from the waters (9 doubles
+        a water) and their Euler angles: the orientation of the water nearest to another one in Euler angle space,
+        moved onto the oxygen nearest to another one. conf receives the O, H1 and H2 positions.
+    */
+    double pi = 3.14159265359;
+    vector<double > tmp5;
+    for (int i = 0; i < waters.size(); i++) {
+        if (i%9 == 0 || i%9 == 1 || i%9 == 2) {
+            tmp5.push_back(waters[i]);
+        }
+    }
+    kdtree<3> trans(tmp5);
+    int transi = 0;
+    vector<int> indt(trans.npts);
+    vector<double> distt(trans.npts);
+    trans.all_nearest(1, &indt[0], &distt[0]);
+    double winner = 10000.00;
+    for (int i = 0; i < trans.npts; i++) {
+        if (distt[i] < winner) {
+            winner = distt[i];
+            transi = indt[i];
+        }
+    }
+    kdtree<3> orient(euler);
+    orient.setperiod(1, 2*pi);
+    orient.setperiod(2, 2*pi);
+    int orienti = 0;
+    vector<int> indo(orient.npts);
+    vector<double> disto(orient.npts);
+    orient.all_nearest(1, &indo[0], &disto[0]);
+    winner = 10000.00;
+    for (int i = 0; i < orient.npts; i++) {
+        if (disto[i] < winner) {
+            winner = disto[i];
+            orienti = indo[i];
+        }
+    }
+    for (int d = 0; d < 3; d++) {
+        double shift = trans.coordinate(transi, d) - waters[orienti*9 + d];
+        for (int a = 0; a < 3; a++) conf[3*a + d] = waters[orienti*9 + 3*a + d] + shift;
+    }
+}
+
+void siteentropy(const vector<double> &stdwaters, const vector<double> &expwaters, double eps, bool single, int kmax,
+                 vector<double> &trans, vector<double> &orient, double *probable = NULL, double *transdist = NULL,
+                 double *translog = NULL, double *orientdist = NULL, double *orientlog = NULL) {
+    /*
+        kdhsa102 on waters in memory, O, H1 and H2 positions (9 doubles a water) of the standard and the expanded
+        cluster. trans and orient receive the kmax translational and orientational entropies of the site, probable
+        if given the most probable configuration of the standard cluster. The others if given receive, kmax doubles
+        a standard water, the translational and orientational neighbour distances and log terms of the same
+        searches, NaN where a water is left out.
+    */
+    if (stdwaters.empty() || expwaters.empty()) throw("no waters in the standard or the expanded cluster");
+    vector<double > tmp5;
+    for (int i = 0; i < stdwaters.size(); i++) {
+        if (i%9 == 0 || i%9 == 1 || i%9 == 2) {
+            tmp5.push_back(stdwaters[i]);
+        }
+    }
+    trans = single ? transentropy<float>(expwaters, tmp5, eps, kmax, transdist, translog)
+                   : transentropy<double>(expwaters, tmp5, eps, kmax, transdist, translog);
+    vector<double > tmp3 = eulerangles(stdwaters);
+    orient = single ? oriententropy<float>(tmp3, eps, kmax, orientdist, orientlog)
+                    : oriententropy<double>(tmp3, eps, kmax, orientdist, orientlog);
+    if (probable) probableconfig(stdwaters, tmp3, probable);
+}
+
+static double walltime() {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+static void checkoffsets(const vector<double> &stdwaters, const vector<long> &stdoff,
+                         const vector<double> &expwaters, const vector<long> &expoff) {
+    //the CSR site layout of siteentropies
+    int nsites = stdoff.size() - 1;
+    if (nsites < 0 || expoff.size() != stdoff.size()) throw("the standard and expanded offsets must cover the same sites");
+    for (int i = 0; i < nsites; i++) {
+        if (stdoff[i] < 0 || stdoff[i] > stdoff[i + 1] || 9*stdoff[i + 1] > stdwaters.size() ||
+            expoff[i] < 0 || expoff[i] > expoff[i + 1] || 9*expoff[i + 1] > expwaters.size())
+            throw("offsets out of order or past the end of the waters");
+    }
+}
+
+template <class Site>
+static void runsites(const vector<long> &stdoff, const vector<long> &expoff, int nthreads, Site &site) {
+    /*
+        Calls site(i) for every site. A few buried sites usually hold most of the waters. Sites are taken largest
+        first: those with more than their share of the work of one thread run one after the other, each with all
+        nthreads (0 for the OpenMP default) building and searching its trees, the rest are handed out one at a time
+        to whichever thread is free.
+    */
+    int nsites = stdoff.size() - 1;
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+    vector<pair<long, int> > order(nsites);
+    long total = 0;
+    for (int i = 0; i < nsites; i++) {
+        order[i].first = -(stdoff[i + 1] - stdoff[i] + expoff[i + 1] - expoff[i]);
+        order[i].second = i;
+        total -= order[i].first;
+    }
+    sort(order.begin(), order.end());
+    int nbig = 0;
+    while (nthreads > 1 && nbig < nsites && -order[nbig].first*nthreads > total) {
+        site(order[nbig].second);
+        nbig++;
+    }
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+    for (int j = nbig; j < nsites; j++) {
+        site(order[j].second);
     }
 }
 
+struct entropysite {
+    //one site of siteentropies, a site that fails keeps its NaNs
+    const vector<double> &stdwaters, &expwaters;
+    const vector<long> &stdoff, &expoff;
+    double eps;
+    bool single;
+    int kmax;
+    vector<double> &trans, &orient, &probable, &seconds;
+    double *nn[4];
+    entropysite(const vector<double> &stdwaters, const vector<long> &stdoff, const vector<double> &expwaters,
+                const vector<long> &expoff, double eps, bool single, int kmax, vector<double> &trans,
+                vector<double> &orient, vector<double> &probable, vector<double> &seconds)
+        : stdwaters(stdwaters), expwaters(expwaters), stdoff(stdoff), expoff(expoff), eps(eps), single(single),
+          kmax(kmax), trans(trans), orient(orient), probable(probable), seconds(seconds) {}
+    void operator()(int i) {
+        double start = walltime();
+        double *site[4];
+        for (int q = 0; q < 4; q++) site[q] = nn[q] ? nn[q] + stdoff[i]*kmax : NULL;
+        //nothing may leave the OpenMP loop, whatever fails (a throw for a site without waters, bad_alloc for a
+        //huge one) leaves this site alone
+        try {
+            vector<double> stdsite(stdwaters.begin() + 9*stdoff[i], stdwaters.begin() + 9*stdoff[i + 1]);
+            vector<double> expsite(expwaters.begin() + 9*expoff[i], expwaters.begin() + 9*expoff[i + 1]);
+            vector<double> s_trans, s_orient;
+            double conf[9];
+            siteentropy(stdsite, expsite, eps, single, kmax, s_trans, s_orient, conf, site[0], site[1], site[2],
+                        site[3]);
+            for (int k = 0; k < kmax; k++) {
+                trans[i*kmax + k] = s_trans[k];
+                orient[i*kmax + k] = s_orient[k];
+            }
+            for (int j = 0; j < 9; j++) probable[9*i + j] = conf[j];
+        }
+        catch (...) {}
+        seconds[i] = walltime() - start;
+    }
+};
 
-void kdhsa102(string infile, string expfile) {
+void siteentropies(const vector<double> &stdwaters, const vector<long> &stdoff, const vector<double> &expwaters,
+                   const vector<long> &expoff, double eps, bool single, int kmax, int nthreads,
+                   vector<double> &trans, vector<double> &orient, vector<double> &probable, vector<double> &seconds,
+                   double *transdist = NULL, double *translog = NULL, double *orientdist = NULL,
+                   double *orientlog = NULL) {
+    /*
+        siteentropy for every site of the system at once. The waters of all standard clusters are stored one
+        site after the other in stdwaters, those of site i being waters stdoff[i] to stdoff[i + 1] - 1, and the
+        same for the expanded clusters. trans and orient receive kmax entropies a site, probable 9 doubles a site
+        and seconds the time each site took; a site that fails (no waters, out of memory) gets NaNs. The per water
+        distances and log terms of siteentropy, if asked for, are kmax doubles for each of the stdoff[n] standard
+        waters. The sites are spread over nthreads threads as runsites does.
+    */
+    checkoffsets(stdwaters, stdoff, expwaters, expoff);
+    int nsites = stdoff.size() - 1;
+    trans.assign(nsites*kmax, NAN);
+    orient.assign(nsites*kmax, NAN);
+    probable.assign(9*nsites, NAN);
+    seconds.assign(nsites, 0);
+    entropysite site(stdwaters, stdoff, expwaters, expoff, eps, single, kmax, trans, orient, probable, seconds);
+    site.nn[0] = transdist;
+    site.nn[1] = translog;
+    site.nn[2] = orientdist;
+    site.nn[3] = orientlog;
+    for (int q = 0; q < 4; q++) {
+        if (site.nn[q]) fill(site.nn[q], site.nn[q] + stdoff[nsites]*kmax, NAN);
+    }
+    runsites(stdoff, expoff, nthreads, site);
+}
+
+template <typename Scalar>
+void transconvergence(const vector<double> &expwaters, const vector<int> &expgroup, const vector<double> &cls,
+                      const vector<int> &clsgroup, const vector<int> &frames, double eps, double *sblock,
+                      double *sprefix) {
+    //translational entropies of the blocks and prefixes of siteconvergence, coordinates as in transentropy
+    double origin[3] = {0, 0, 0};
+    if (sizeof(Scalar) < sizeof(double) && expwaters.size() >= 3) {
+        for (int i = 0; i < 3; i++) origin[i] = expwaters[i];
+    }
+    vector<Scalar> oxygens;
+    oxygens.reserve(expwaters.size()/3);
+    for (int i = 0; i < expwaters.size(); i++) {
+        if (i%9 == 0 || i%9 == 1 || i%9 == 2) oxygens.push_back(expwaters[i] - origin[i%3]);
+    }
+    kdtree<3, Scalar> trans(oxygens);
+    vector<Scalar> q(cls.size());
+    for (int i = 0; i < cls.size(); i++) q[i] = cls[i] - origin[i%3];
+    trans.setepsilon(eps);
+    trans.run_tree_trans(q, &clsgroup[0], &expgroup[0], frames.size(), &frames[0], sblock, sprefix);
+}
+
+template <typename Scalar>
+void orientconvergence(const vector<double> &euler, const vector<int> &group, int ngroup, double eps,
+                       double *sblock, double *sprefix) {
+    //orientational entropies of the blocks and prefixes of siteconvergence
+    double pi = 3.14159265359;
+    vector<Scalar> vals(euler.begin(), euler.end());
+    kdtree<3, Scalar> orient(vals);
+    orient.setperiod(1, 2*pi);
+    orient.setperiod(2, 2*pi);
+    orient.setepsilon(eps);
+    orient.run_tree_orient(&group[0], ngroup, sblock, sprefix);
+}
+
+void siteconvergence(const vector<double> &stdwaters, const vector<int> &stdframes, const vector<double> &expwaters,
+                     const vector<int> &expframes, int nframes, int nblocks, double eps, bool single,
+                     double *btrans, double *borient, double *ptrans, double *porient) {
+    /*
+        siteentropy over windows of the trajectory, for convergence checks. Every water is tagged with its frame,
+        0..nframes-1, and the frames are cut into nblocks blocks of (nearly) equal length. btrans and borient
+        receive the entropies of each block on its own, ptrans and porient those of the growing prefixes, blocks
+        0..j for j = 0..nblocks-1, the last being the entropy of the whole trajectory. All windows come from one
+        tree and one search per water and cost about as much as a few neighbour searches of siteentropy; the
+        entropy of a window without waters is NaN.
+    */
+    if (stdwaters.empty() || expwaters.empty()) throw("no waters in the standard or the expanded cluster");
+    if (nblocks < 1 || nframes < 1) throw("the number of frames and of blocks must be positive");
+    if (stdframes.size() != stdwaters.size()/9 || expframes.size() != expwaters.size()/9)
+        throw("one frame is needed for every water");
+    vector<int> frames(nblocks, 0), stdgroup(stdframes.size()), expgroup(expframes.size());
+    for (int f = 0; f < nframes; f++) frames[(long)f*nblocks/nframes]++;
+    for (int i = 0; i < stdframes.size(); i++) {
+        if (stdframes[i] < 0 || stdframes[i] >= nframes) throw("frame out of range");
+        stdgroup[i] = (long)stdframes[i]*nblocks/nframes;
+    }
+    for (int i = 0; i < expframes.size(); i++) {
+        if (expframes[i] < 0 || expframes[i] >= nframes) throw("frame out of range");
+        expgroup[i] = (long)expframes[i]*nblocks/nframes;
+    }
+    vector<double > tmp5;
+    for (int i = 0; i < stdwaters.size(); i++) {
+        if (i%9 == 0 || i%9 == 1 || i%9 == 2) {
+            tmp5.push_back(stdwaters[i]);
+        }
+    }
+    if (single) transconvergence<float>(expwaters, expgroup, tmp5, stdgroup, frames, eps, btrans, ptrans);
+    else transconvergence<double>(expwaters, expgroup, tmp5, stdgroup, frames, eps, btrans, ptrans);
+    vector<double > tmp3 = eulerangles(stdwaters);
+    if (single) orientconvergence<float>(tmp3, stdgroup, nblocks, eps, borient, porient);
+    else orientconvergence<double>(tmp3, stdgroup, nblocks, eps, borient, porient);
+}
+
+struct convergencesite {
+    //one site of siteconvergences, a site that fails keeps its NaNs
+    const vector<double> &stdwaters, &expwaters;
+    const vector<int> &stdframes, &expframes;
+    const vector<long> &stdoff, &expoff;
+    int nframes, nblocks;
+    double eps;
+    bool single;
+    vector<double> &btrans, &borient, &ptrans, &porient;
+    convergencesite(const vector<double> &stdwaters, const vector<int> &stdframes, const vector<long> &stdoff,
+                    const vector<double> &expwaters, const vector<int> &expframes, const vector<long> &expoff,
+                    int nframes, int nblocks, double eps, bool single, vector<double> &btrans,
+                    vector<double> &borient, vector<double> &ptrans, vector<double> &porient)
+        : stdwaters(stdwaters), expwaters(expwaters), stdframes(stdframes), expframes(expframes), stdoff(stdoff),
+          expoff(expoff), nframes(nframes), nblocks(nblocks), eps(eps), single(single), btrans(btrans),
+          borient(borient), ptrans(ptrans), porient(porient) {}
+    void operator()(int i) {
+        //as in entropysite nothing may leave the OpenMP loop
+        try {
+            vector<double> stdsite(stdwaters.begin() + 9*stdoff[i], stdwaters.begin() + 9*stdoff[i + 1]);
+            vector<double> expsite(expwaters.begin() + 9*expoff[i], expwaters.begin() + 9*expoff[i + 1]);
+            vector<int> stdf(stdframes.begin() + stdoff[i], stdframes.begin() + stdoff[i + 1]);
+            vector<int> expf(expframes.begin() + expoff[i], expframes.begin() + expoff[i + 1]);
+            vector<double> s(4*nblocks);
+            siteconvergence(stdsite, stdf, expsite, expf, nframes, nblocks, eps, single, &s[0], &s[nblocks],
+                            &s[2*nblocks], &s[3*nblocks]);
+            for (int j = 0; j < nblocks; j++) {
+                btrans[i*nblocks + j] = s[j];
+                borient[i*nblocks + j] = s[nblocks + j];
+                ptrans[i*nblocks + j] = s[2*nblocks + j];
+                porient[i*nblocks + j] = s[3*nblocks + j];
+            }
+        }
+        catch (...) {}
+    }
+};
+
+void siteconvergences(const vector<double> &stdwaters, const vector<int> &stdframes, const vector<long> &stdoff,
+                      const vector<double> &expwaters, const vector<int> &expframes, const vector<long> &expoff,
+                      int nframes, int nblocks, double eps, bool single, int nthreads, vector<double> &btrans,
+                      vector<double> &borient, vector<double> &ptrans, vector<double> &porient) {
+    /*
+        siteconvergence for every site, the waters and their frames laid out as for siteentropies. Each output
+        holds nblocks entropies a site, NaN for a site that fails.
+    */
+    checkoffsets(stdwaters, stdoff, expwaters, expoff);
+    if (stdframes.size() != stdwaters.size()/9 || expframes.size() != expwaters.size()/9)
+        throw("one frame is needed for every water");
+    if (nblocks < 1 || nframes < 1) throw("the number of frames and of blocks must be positive");
+    for (int i = 0; i < stdframes.size(); i++) {
+        if (stdframes[i] < 0 || stdframes[i] >= nframes) throw("frame out of range");
+    }
+    for (int i = 0; i < expframes.size(); i++) {
+        if (expframes[i] < 0 || expframes[i] >= nframes) throw("frame out of range");
+    }
+    int nsites = stdoff.size() - 1;
+    btrans.assign(nsites*nblocks, NAN);
+    borient.assign(nsites*nblocks, NAN);
+    ptrans.assign(nsites*nblocks, NAN);
+    porient.assign(nsites*nblocks, NAN);
+    convergencesite site(stdwaters, stdframes, stdoff, expwaters, expframes, expoff, nframes, nblocks, eps, single,
+                         btrans, borient, ptrans, porient);
+    runsites(stdoff, expoff, nthreads, site);
+}
+
+void kdhsa102(string infile, string expfile, string treefile, double eps, bool single, int kmax, bool append,
+              vector<double> &trans, vector<double> &orient) {
+    /*
+        trans and orient receive the kmax translational and orientational entropies of the site, append also adds
+        them as a line to trans.dat and orient.dat in the working directory.
+    */
     /*
     if (argc <= 1) {
         cerr << "\nUSAGE:\n\n"
@@ -182,14 +618,14 @@ void kdhsa102(string infile, string expfile) {
     }
     */
 
-    double s = 0;
+    vector<double> s;
 
-    ofstream transout("trans.dat", ios::app); transout.precision(16);
-    ofstream orientout("orient.dat", ios::app); orientout.precision(16);
+    ofstream transout, orientout;
+    if (append) {
+        transout.open("trans.dat", ios::app); transout.precision(16);
+        orientout.open("orient.dat", ios::app); orientout.precision(16);
+    }
 
-    clock_t t;
-    t = clock();
-    int i = 0;
     //double x = 0, y = 0, z = 0;
     
     //while (i<argc) {
@@ -229,232 +665,29 @@ void kdhsa102(string infile, string expfile) {
         exit(0);
     }
     */
-    vector<double > tmp;
-    double temp;
-    string strtemp;
-    ifstream input(expfile.c_str());
-    //getline(input, strtemp); //skip header
-    while (!input.eof()) {
-        getline(input, strtemp);
-        if (!strtemp.empty()) {
-            temp = atof(strtemp.substr(31, 7).c_str());
-            tmp.push_back(temp);
-            temp = atof(strtemp.substr(39, 7).c_str());
-            tmp.push_back(temp);
-            temp = atof(strtemp.substr(47, 7).c_str());
-            tmp.push_back(temp);
-        }
-    }
-    vector<double > tmp2;
-    for (int i = 0; i < tmp.size(); i++) {
-        if (i%9 == 0 || i%9==1 || i%9==2) {
-            tmp2.push_back(tmp[i]);
-        }
-    }
-    /*
-    ofstream tout("test.dat"); tout.precision(16);
-    tout << tmp2.size() << endl;
-    for (int i = 0; i < tmp2.size(); i++) {
-        tout << tmp2[i] << "\t";
-        if (i%3== 2 && i!=0) {
-            tout << endl;
-        }
-    }
-    */
-    kdtree trans(tmp2);
     //cout << "made trans tree" << endl;
 
-    vector<double > tmp4;
-    ifstream stput(infile.c_str());
-    getline(stput, strtemp); //skip header
-    while (!stput.eof()) {
-        getline(stput, strtemp);
-        if (!strtemp.empty()) {
-            temp = atof(strtemp.substr(31, 7).c_str());
-            tmp4.push_back(temp);
-            temp = atof(strtemp.substr(39, 7).c_str());
-            tmp4.push_back(temp);
-            temp = atof(strtemp.substr(47, 7).c_str());
-            tmp4.push_back(temp);
-        }
-    }
-    vector<double > tmp5;
-    for (int i = 0; i < tmp4.size(); i++) {
-        if (i%9 == 0 || i%9 == 1 || i%9 == 2) {
-            tmp5.push_back(tmp4[i]);
-        }
-    }
+    vector<double> tmp4 = pdbread(infile, true);
+    vector<double> tmp5 = pdboxygens(tmp4);
 
-    s = trans.run_tree_trans(tmp5);
-    transout << s << endl;
-    transout.close();
+    s = single ? transentropy<float>(expfile, treefile, tmp5, eps, kmax) : transentropy<double>(expfile, treefile, tmp5, eps, kmax);
+    trans = s;
+    if (append) {
+        for (int k = 0; k < kmax; k++) transout << (k ? " " : "") << s[k];
+        transout << endl;
+        transout.close();
+    }
     /*
         Begin orientational code
     */
-    vector<double > tmp3;
-    double pi = 3.14159265359; double cenndist = 10000;
-    int x_ref[3]; int y_ref[3]; int z_ref[3];
-    x_ref[0] = 1; x_ref[1] = 0; x_ref[2] = 0;
-    y_ref[0] = 0; y_ref[1] = 1; y_ref[2] = 0;
-    z_ref[0] = 0; z_ref[1] = 0; z_ref[2] = 1;
-    double ar[3]; double ar2; double h12; double h22; double h1length; double h2length; double arlength; double dotprohah1; double theta;
-    double crossp_x_ref_h1[3]; double crossp_x_ref_h1_sign; double q[4]; double htemp[3]; double z_mol_vect[3];  double z_mol_vect2;
-    double z_mol_vectlength; double dotproductz_mol_vectz_ref; double theta3p; double crossp_z_mol_vectz_ref[3]; double crossp_z_mol_vectz_ref_sign;
-    double q2[4]; double e[4]; double singtest;
-    for (int i = 0; i < tmp4.size(); i+=9) {
-        tmp4[i+8] -= tmp4[i+2];
-        tmp4[i+5] -= tmp4[i+2];
-        tmp4[i+2] -= tmp4[i+2];
-        tmp4[i+7] -= tmp4[i+1];
-        tmp4[i+4] -= tmp4[i+1];
-        tmp4[i+1] -= tmp4[i+1];
-        tmp4[i+6] -= tmp4[i];
-        tmp4[i+3] -= tmp4[i];
-        tmp4[i] -= tmp4[i];
-        h12 = pow(tmp4[i+3],2) + pow(tmp4[i+4],2) + pow(tmp4[i+5],2);
-        h22 = pow(tmp4[i+6],2) + pow(tmp4[i+7],2) + pow(tmp4[i+8],2);
-        h1length = pow(h12, 0.5);
-        h2length = pow(h22, 0.5);
-        if (tmp4[i+3] != 0) {
-            tmp4[i+3] /= h1length;
-        }
-        if (tmp4[i+4] != 0) {
-            tmp4[i+4] /= h1length;
-        }
-        if (tmp4[i+5] != 0) {
-            tmp4[i+5] /= h1length;
-        }
-        if (tmp4[i+6] != 0) {
-            tmp4[i+6] /= h1length;
-        }
-        if (tmp4[i+7] != 0) {
-            tmp4[i+7] /= h1length;
-        }
-        if (tmp4[i+7] != 0) {
-            tmp4[i+7] /= h1length;
-        }
-        ar[0]=tmp4[i+4]*x_ref[2] - tmp4[i+5]*x_ref[1];
-        ar[1]=tmp4[i+5]*x_ref[0] - tmp4[i+3]*x_ref[2];
-        ar[2]=tmp4[i+3]*x_ref[1] - tmp4[i+4]*x_ref[0];
-        ar2 = pow(ar[0],2) + pow(ar[1],2) + pow(ar[2],2);
-        arlength = pow(ar2, 0.5);
-        if (ar[0] != 0) {
-            ar[0] /= arlength;
-        }
-        if (ar[1] != 0) {
-            ar[1] /= arlength;
-        }
-        if (ar[2] != 0) {
-            ar[2] /= arlength;
-        }
-        dotprohah1 = 0;
-        dotprohah1 += x_ref[0]*tmp4[i+3];
-        dotprohah1 += x_ref[1]*tmp4[i+4];
-        dotprohah1 += x_ref[2]*tmp4[i+5];
-        theta = acos(dotprohah1);
-        crossp_x_ref_h1[0]=tmp4[i+4]*x_ref[2] - tmp4[i+5]*x_ref[1];
-        crossp_x_ref_h1[1]=tmp4[i+5]*x_ref[0] - tmp4[i+3]*x_ref[2];
-        crossp_x_ref_h1[2]=tmp4[i+3]*x_ref[1] - tmp4[i+4]*x_ref[0];
-        crossp_x_ref_h1_sign=crossp_x_ref_h1[0]*tmp4[i+3]+crossp_x_ref_h1[1]*tmp4[i+4]+crossp_x_ref_h1[2]*tmp4[i+5];
-        if (crossp_x_ref_h1_sign > 0) {
-            theta /=2;
-        }
-        else {
-            theta /=-2;
-        }
-        q[0]=cos(theta);
-        q[1]=ar[0]*sin(theta);
-        q[2]=ar[1]*sin(theta);
-        q[3]=ar[2]*sin(theta);
-
-        htemp[0]= ((pow(q[0],2)+pow(q[1],2))-(pow(q[2],2)+pow(q[3],2)))* tmp4[i+3];
-        htemp[0]= (2*(q[1]*q[2] + q[0]*q[3]) * tmp4[i+4] ) + htemp[0];
-        htemp[0]= (2*(q[1]*q[3]-q[0]*q[2])*tmp4[i+5]) + htemp[0];
-        htemp[1]= 2*( q[1]*q[2] - q[0]*q[3] ) * tmp4[i+3];
-        htemp[1]= ( ( q[0]*q[0]-q[1]*q[1]+q[2]*q[2]-q[3]*q[3] ) * tmp4[i+4] ) + htemp[1];
-        htemp[1]= ( 2*( q[2]*q[3] + q[0]*q[1] ) * tmp4[i+5] ) + htemp[1];
-        htemp[2]= 2*( q[1]*q[3] + q[0]*q[2]) * tmp4[i+3];
-        htemp[2]= ( 2*( q[2]*q[3]-q[0]*q[1] ) * tmp4[i+4] ) + htemp[2];
-        htemp[2]=  ( ( q[0]*q[0]-q[1]*q[1]-q[2]*q[2]+q[3]*q[3] ) * tmp4[i+5] ) + htemp[2];
-        tmp4[i+3]=htemp[0];
-        tmp4[i+4]=htemp[1];
-        tmp4[i+5]=htemp[2];
-        htemp[0]= ((pow(q[0],2)+pow(q[1],2))-(pow(q[2],2)+pow(q[3],2)))* tmp4[i+6];
-        htemp[0]= (2*(q[1]*q[2] + q[0]*q[3]) * tmp4[i+7] ) + htemp[0];
-        htemp[0]= (2*(q[1]*q[3]-q[0]*q[2])*tmp4[i+8]) + htemp[0];
-        htemp[1]= 2*( q[1]*q[2] - q[0]*q[3] ) * tmp4[i+6];
-        htemp[1]= ( ( q[0]*q[0]-q[1]*q[1]+q[2]*q[2]-q[3]*q[3] ) * tmp4[i+7] ) + htemp[1];
-        htemp[1]= ( 2*( q[2]*q[3] + q[0]*q[1] ) * tmp4[i+8] ) + htemp[1];
-        htemp[2]= 2*( q[1]*q[3] + q[0]*q[2]) * tmp4[i+6];
-        htemp[2]= ( 2*( q[2]*q[3]-q[0]*q[1] ) * tmp4[i+7] ) + htemp[2];
-        htemp[2]=  ( ( q[0]*q[0]-q[1]*q[1]-q[2]*q[2]+q[3]*q[3] ) * tmp4[i+8] ) + htemp[2];
-        tmp4[i+6]=htemp[0];
-        tmp4[i+7]=htemp[1];
-        tmp4[i+8]=htemp[2];
-        z_mol_vect[0]=tmp4[i+4]*tmp4[i+8] - tmp4[i+5]*tmp4[i+7];
-        z_mol_vect[1]=tmp4[i+5]*tmp4[i+6] - tmp4[i+3]*tmp4[i+8];
-        z_mol_vect[2]=tmp4[i+3]*tmp4[i+7] - tmp4[i+4]*tmp4[i+6];
-        z_mol_vect2= pow(z_mol_vect[0],2) + pow(z_mol_vect[1],2) + pow(z_mol_vect[2],2);
-        z_mol_vectlength=pow(z_mol_vect2,0.5);
-        if (z_mol_vect[0] !=0) {
-            z_mol_vect[0] /= z_mol_vectlength;
-        }
-        if (z_mol_vect[1] !=0) {
-            z_mol_vect[1] /= z_mol_vectlength;
-        }
-        if (z_mol_vect[2] !=0) {
-            z_mol_vect[2] /= z_mol_vectlength;
-        }
-        dotproductz_mol_vectz_ref=0;
-        for(int j=0;j<3;j++) {
-            dotproductz_mol_vectz_ref+=z_mol_vect[j]*z_ref[j];
-        }
-        theta3p= acos(dotproductz_mol_vectz_ref);
-
-        crossp_z_mol_vectz_ref[0]=z_mol_vect[1]*z_ref[2] - z_mol_vect[2]*z_ref[1];
-        crossp_z_mol_vectz_ref[1]=z_mol_vect[2]*z_ref[0] - z_mol_vect[0]*z_ref[2];
-        crossp_z_mol_vectz_ref[2]=z_mol_vect[0]*z_ref[1] - z_mol_vect[1]*z_ref[0];
-
-        crossp_z_mol_vectz_ref_sign=crossp_z_mol_vectz_ref[0]*tmp4[i+3]+crossp_z_mol_vectz_ref[1]*tmp4[i+4]+crossp_z_mol_vectz_ref[2]*tmp4[i+5];
-
-        if (crossp_z_mol_vectz_ref_sign < 0) {
-            theta3p /=2;
-        }
-        else {
-            theta3p /=-2;
-        }
-
-        q2[0]=cos(theta3p);
-        q2[1]=x_ref[0]*sin(theta3p);
-        q2[2]=x_ref[1]*sin(theta3p);
-        q2[3]=x_ref[2]*sin(theta3p);
-
-        e[0]= q[0]*q2[0]  -  q[1]*q2[1]  -  q[2]*q2[2]  -  q[3]*q2[3];
-        e[1]= q[0]*q2[1]  +  q[1]*q2[0]  +  q[2]*q2[3]  -  q[3]*q2[2];
-        e[2]= q[0]*q2[2]  -  q[1]*q2[3]  +  q[2]*q2[0]  +  q[3]*q2[1];
-        e[3]= q[0]*q2[3]  +  q[1]*q2[2]  -  q[2]*q2[1]  +  q[3]*q2[0];
-
-        singtest=((e[1]*e[2]) + (e[3]*e[0]));
-        if (singtest > 0.4999) {
-            tmp3.push_back(sin(pi/2));
-            tmp3.push_back(0);
-            tmp3.push_back(2*atan2(e[1],e[0]));
-        }
-        else if (singtest < -0.4999) {
-            tmp3.push_back(sin(pi/-2));
-            tmp3.push_back(0);
-            tmp3.push_back(-2*atan2(e[1], e[0]));
-        }
-        else {
-            tmp3.push_back(sin(asin(2*singtest)));
-            tmp3.push_back(atan2(((2*e[1]*e[0])-(2*e[2]*e[3])) , (1 - (2*pow(e[1],2)) - (2*pow(e[3],2)))));
-            tmp3.push_back(atan2(((2*e[2]*e[0])-(2*e[1]*e[3])) , (1 - (2*pow(e[2],2)) - (2*pow(e[3],2)))));
-        }
-    }
-    kdtree orient(tmp3);
-    s = orient.run_tree_orient();
-    orientout << s << endl;
-    orientout.close();
+    vector<double > tmp3 = eulerangles(tmp4);
+    s = single ? oriententropy<float>(tmp3, eps, kmax) : oriententropy<double>(tmp3, eps, kmax);
+    orient = s;
+    if (append) {
+        for (int k = 0; k < kmax; k++) orientout << (k ? " " : "") << s[k];
+        orientout << endl;
+        orientout.close();
+    }
 
 
     //t = clock() -t;
@@ -463,6 +696,8 @@ void kdhsa102(string infile, string expfile) {
 }
 
 void sixdimprob(string infile) {
+    //appends to probcenters.pdb the water of the standard cluster infile nearest on average to its three nearest
+    //neighbours in the six dimensional metric, the most probable configuration of the site
     /*
     if (argc <= 1) {
         cerr << "\nUSAGE:\n\n"
@@ -480,9 +715,6 @@ void sixdimprob(string infile) {
     ofstream probout("probcenters.pdb", ios::app);
 
 
-    clock_t t;
-    t = clock();
-    int i = 0; 
     /*   
     while (i<argc) {
         if (!strcmp(argv[i], "-i")) {
@@ -491,189 +723,18 @@ void sixdimprob(string infile) {
         i++;
     }
     */
-    if (infile.empty()) {
-        cerr << "infile needs to be defined\n"
-        << "For full run instructions run executable with no arguments\n\n";
-        exit(0);
-    }
+    if (infile.empty()) throw("infile needs to be defined");
 
-    double temp;
-    string strtemp;
-    
-    vector<double > tmp4; //tmp4 contains all water atom coordinates
-    ifstream stput(infile.c_str());
-    getline(stput, strtemp); //skip header
-    while (!stput.eof()) {
-        getline(stput, strtemp);
-        if (!strtemp.empty()) {
-            temp = atof(strtemp.substr(31, 7).c_str());
-            tmp4.push_back(temp);
-            temp = atof(strtemp.substr(39, 7).c_str());
-            tmp4.push_back(temp);
-            temp = atof(strtemp.substr(47, 7).c_str());
-            tmp4.push_back(temp);
-        }
-    }
-    vector<double> tmp2; //storage for waters before adjusted for angles
-    vector<double > tmp5; //tmp5 contains the oxygen x y z
-    for (int i = 0; i < tmp4.size(); i++) {
-        if (i%9 == 0 || i%9 == 1 || i%9 == 2) {
-            tmp5.push_back(tmp4[i]);
-        }
-        tmp2.push_back(tmp4[i]);
-    }
+    vector<double> tmp2 = pdbread(infile, true); //storage for waters before adjusted for angles
+    if (tmp2.empty()) throw("no waters in the cluster file");
+    vector<double> tmp5 = pdboxygens(tmp2); //tmp5 contains the oxygen x y z
 
  
     /*
         Begin euler angle (quaternion) code
     */
-    vector<double > tmp3; //will contain the quaternion description of the waters orientation
-    double pi = 3.14159265359; double cenndist = 10000;
-    int x_ref[3]; int y_ref[3]; int z_ref[3];
-    x_ref[0] = 1; x_ref[1] = 0; x_ref[2] = 0;
-    y_ref[0] = 0; y_ref[1] = 1; y_ref[2] = 0;
-    z_ref[0] = 0; z_ref[1] = 0; z_ref[2] = 1;
-    double ar[3]; double ar2; double h12; double h22; double h1length; double h2length; double arlength; double dotprohah1; double theta;
-    double crossp_x_ref_h1[3]; double crossp_x_ref_h1_sign; double q[4]; double htemp[3]; double z_mol_vect[3];  double z_mol_vect2;
-    double z_mol_vectlength; double dotproductz_mol_vectz_ref; double theta3p; double crossp_z_mol_vectz_ref[3]; double crossp_z_mol_vectz_ref_sign;
-    double q2[4]; double e[4]; double singtest;
-    for (int i = 0; i < tmp4.size(); i+=9) {
-        tmp4[i+8] -= tmp4[i+2];
-        tmp4[i+5] -= tmp4[i+2];
-        tmp4[i+2] -= tmp4[i+2];
-        tmp4[i+7] -= tmp4[i+1];
-        tmp4[i+4] -= tmp4[i+1];
-        tmp4[i+1] -= tmp4[i+1];
-        tmp4[i+6] -= tmp4[i];
-        tmp4[i+3] -= tmp4[i];
-        tmp4[i] -= tmp4[i];
-        h12 = pow(tmp4[i+3],2) + pow(tmp4[i+4],2) + pow(tmp4[i+5],2);
-        h22 = pow(tmp4[i+6],2) + pow(tmp4[i+7],2) + pow(tmp4[i+8],2);
-        h1length = pow(h12, 0.5);
-        h2length = pow(h22, 0.5);
-        if (tmp4[i+3] != 0) {
-            tmp4[i+3] /= h1length;
-        }
-        if (tmp4[i+4] != 0) {
-            tmp4[i+4] /= h1length;
-        }
-        if (tmp4[i+5] != 0) {
-            tmp4[i+5] /= h1length;
-        }
-        if (tmp4[i+6] != 0) {
-            tmp4[i+6] /= h1length;
-        }
-        if (tmp4[i+7] != 0) {
-            tmp4[i+7] /= h1length;
-        }
-        if (tmp4[i+7] != 0) {
-            tmp4[i+7] /= h1length;
-        }
-        ar[0]=tmp4[i+4]*x_ref[2] - tmp4[i+5]*x_ref[1];
-        ar[1]=tmp4[i+5]*x_ref[0] - tmp4[i+3]*x_ref[2];
-        ar[2]=tmp4[i+3]*x_ref[1] - tmp4[i+4]*x_ref[0];
-        ar2 = pow(ar[0],2) + pow(ar[1],2) + pow(ar[2],2);
-        arlength = pow(ar2, 0.5);
-        if (ar[0] != 0) {
-            ar[0] /= arlength;
-        }
-        if (ar[1] != 0) {
-            ar[1] /= arlength;
-        }
-        if (ar[2] != 0) {
-            ar[2] /= arlength;
-        }
-        dotprohah1 = 0;
-        dotprohah1 += x_ref[0]*tmp4[i+3];
-        dotprohah1 += x_ref[1]*tmp4[i+4];
-        dotprohah1 += x_ref[2]*tmp4[i+5];
-        theta = acos(dotprohah1);
-        crossp_x_ref_h1[0]=tmp4[i+4]*x_ref[2] - tmp4[i+5]*x_ref[1];
-        crossp_x_ref_h1[1]=tmp4[i+5]*x_ref[0] - tmp4[i+3]*x_ref[2];
-        crossp_x_ref_h1[2]=tmp4[i+3]*x_ref[1] - tmp4[i+4]*x_ref[0];
-        crossp_x_ref_h1_sign=crossp_x_ref_h1[0]*tmp4[i+3]+crossp_x_ref_h1[1]*tmp4[i+4]+crossp_x_ref_h1[2]*tmp4[i+5];
-        if (crossp_x_ref_h1_sign > 0) {
-            theta /=2;
-        }
-        else {
-            theta /=-2;
-        }
-        q[0]=cos(theta);
-        q[1]=ar[0]*sin(theta);
-        q[2]=ar[1]*sin(theta);
-        q[3]=ar[2]*sin(theta);
-
-        htemp[0]= ((pow(q[0],2)+pow(q[1],2))-(pow(q[2],2)+pow(q[3],2)))* tmp4[i+3];
-        htemp[0]= (2*(q[1]*q[2] + q[0]*q[3]) * tmp4[i+4] ) + htemp[0];
-        htemp[0]= (2*(q[1]*q[3]-q[0]*q[2])*tmp4[i+5]) + htemp[0];
-        htemp[1]= 2*( q[1]*q[2] - q[0]*q[3] ) * tmp4[i+3];
-        htemp[1]= ( ( q[0]*q[0]-q[1]*q[1]+q[2]*q[2]-q[3]*q[3] ) * tmp4[i+4] ) + htemp[1];
-        htemp[1]= ( 2*( q[2]*q[3] + q[0]*q[1] ) * tmp4[i+5] ) + htemp[1];
-        htemp[2]= 2*( q[1]*q[3] + q[0]*q[2]) * tmp4[i+3];
-        htemp[2]= ( 2*( q[2]*q[3]-q[0]*q[1] ) * tmp4[i+4] ) + htemp[2];
-        htemp[2]=  ( ( q[0]*q[0]-q[1]*q[1]-q[2]*q[2]+q[3]*q[3] ) * tmp4[i+5] ) + htemp[2];
-        tmp4[i+3]=htemp[0];
-        tmp4[i+4]=htemp[1];
-        tmp4[i+5]=htemp[2];
-        htemp[0]= ((pow(q[0],2)+pow(q[1],2))-(pow(q[2],2)+pow(q[3],2)))* tmp4[i+6];
-        htemp[0]= (2*(q[1]*q[2] + q[0]*q[3]) * tmp4[i+7] ) + htemp[0];
-        htemp[0]= (2*(q[1]*q[3]-q[0]*q[2])*tmp4[i+8]) + htemp[0];
-        htemp[1]= 2*( q[1]*q[2] - q[0]*q[3] ) * tmp4[i+6];
-        htemp[1]= ( ( q[0]*q[0]-q[1]*q[1]+q[2]*q[2]-q[3]*q[3] ) * tmp4[i+7] ) + htemp[1];
-        htemp[1]= ( 2*( q[2]*q[3] + q[0]*q[1] ) * tmp4[i+8] ) + htemp[1];
-        htemp[2]= 2*( q[1]*q[3] + q[0]*q[2]) * tmp4[i+6];
-        htemp[2]= ( 2*( q[2]*q[3]-q[0]*q[1] ) * tmp4[i+7] ) + htemp[2];
-        htemp[2]=  ( ( q[0]*q[0]-q[1]*q[1]-q[2]*q[2]+q[3]*q[3] ) * tmp4[i+8] ) + htemp[2];
-        tmp4[i+6]=htemp[0];
-        tmp4[i+7]=htemp[1];
-        tmp4[i+8]=htemp[2];
-        z_mol_vect[0]=tmp4[i+4]*tmp4[i+8] - tmp4[i+5]*tmp4[i+7];
-        z_mol_vect[1]=tmp4[i+5]*tmp4[i+6] - tmp4[i+3]*tmp4[i+8];
-        z_mol_vect[2]=tmp4[i+3]*tmp4[i+7] - tmp4[i+4]*tmp4[i+6];
-        z_mol_vect2= pow(z_mol_vect[0],2) + pow(z_mol_vect[1],2) + pow(z_mol_vect[2],2);
-        z_mol_vectlength=pow(z_mol_vect2,0.5);
-        if (z_mol_vect[0] !=0) {
-            z_mol_vect[0] /= z_mol_vectlength;
-        }
-        if (z_mol_vect[1] !=0) {
-            z_mol_vect[1] /= z_mol_vectlength;
-        }
-        if (z_mol_vect[2] !=0) {
-            z_mol_vect[2] /= z_mol_vectlength;
-        }
-        dotproductz_mol_vectz_ref=0;
-        for(int j=0;j<3;j++) {
-            dotproductz_mol_vectz_ref+=z_mol_vect[j]*z_ref[j];
-        }
-        theta3p= acos(dotproductz_mol_vectz_ref);
-
-        crossp_z_mol_vectz_ref[0]=z_mol_vect[1]*z_ref[2] - z_mol_vect[2]*z_ref[1];
-        crossp_z_mol_vectz_ref[1]=z_mol_vect[2]*z_ref[0] - z_mol_vect[0]*z_ref[2];
-        crossp_z_mol_vectz_ref[2]=z_mol_vect[0]*z_ref[1] - z_mol_vect[1]*z_ref[0];
-
-        crossp_z_mol_vectz_ref_sign=crossp_z_mol_vectz_ref[0]*tmp4[i+3]+crossp_z_mol_vectz_ref[1]*tmp4[i+4]+crossp_z_mol_vectz_ref[2]*tmp4[i+5];
-
-        if (crossp_z_mol_vectz_ref_sign < 0) {
-            theta3p /=2;
-        }
-        else {
-            theta3p /=-2;
-        }
-
-        q2[0]=cos(theta3p);
-        q2[1]=x_ref[0]*sin(theta3p);
-        q2[2]=x_ref[1]*sin(theta3p);
-        q2[3]=x_ref[2]*sin(theta3p);
-
-        e[0]= q[0]*q2[0]  -  q[1]*q2[1]  -  q[2]*q2[2]  -  q[3]*q2[3];
-        e[1]= q[0]*q2[1]  +  q[1]*q2[0]  +  q[2]*q2[3]  -  q[3]*q2[2];
-        e[2]= q[0]*q2[2]  -  q[1]*q2[3]  +  q[2]*q2[0]  +  q[3]*q2[1];
-        e[3]= q[0]*q2[3]  +  q[1]*q2[2]  -  q[2]*q2[1]  +  q[3]*q2[0];
-
-        tmp3.push_back(e[0]); tmp3.push_back(e[1]); tmp3.push_back(e[2]); tmp3.push_back(e[3]);
-
-        
-    }
+    vector<double > tmp3(tmp2.size()/9*4); //will contain the quaternion description of the waters orientation
+    if (!tmp3.empty()) waterorient(&tmp2[0], tmp2.size()/9, &tmp3[0], NULL);
     
     /*
         At this point we have tmp3 with quaternion values and tmp5 with oxygen coordinates
@@ -699,32 +760,32 @@ void sixdimprob(string infile) {
 
     }
 
-    kdtree friendlytree(tmp);
-
-    point pt; double* dists; int* winners;
+    //three nearest neighbours of every water in the six dimensional metric of the GIST entropy, q and -q the
+    //same orientation
+    int npts = tmp.size()/7;
+    vptree *friendlytree = vptree_build(tmp.empty() ? NULL : &tmp[0], npts, 1);
+    if (friendlytree == NULL) throw bad_alloc();
+    vector<double> dists(3*npts);
+    vector<int> winners(3*npts);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < npts; i++) {
+        vptree_knearest(friendlytree, &tmp[7*i], i, 3, &winners[3*i], &dists[3*i]);
+    }
+    vptree_free(friendlytree);
 
-    dists = new double[3];
-    winners = new int[3];
-    
     double dtemp;
     double windist = 10000;
     double winner[9];
 
-    for (int i = 0; i < tmp.size(); i+=7) {
-        pt.x[0] =  tmp[i];
-        pt.x[1] =  tmp[i+1];
-        pt.x[2] =  tmp[i+2];
-        pt.x[3] =  tmp[i+3];
-        pt.x[4] =  tmp[i+4];
-        pt.x[5] =  tmp[i+5];
-        pt.x[6] =  tmp[i+6];
-        int watpos = i/7;
-        friendlytree.nnearest(watpos, winners, dists, 3);
-        watpos = watpos*9;
-        for (int j = 0; j < 3; j++) {
-            dtemp += dists[j];
-        }
-        dtemp = dtemp/3;
+    for (int i = 0; i < npts; i++) {
+        int watpos = i*9;
+        dtemp = 0;
+        //sites of fewer than four waters average over the neighbours they have
+        int nk = npts - 1 < 3 ? npts - 1 : 3;
+        for (int j = 0; j < nk; j++) {
+            dtemp += dists[3*i + j];
+        }
+        if (nk > 0) dtemp = dtemp/nk;
         if (dtemp < windist) {
             windist = dtemp;
             winner[0] = tmp2[watpos];
@@ -748,6 +809,7 @@ void sixdimprob(string infile) {
     int pos = 0;
     FILE * pFile;
     pFile = fopen(fileName, "w");
+    if (pFile == NULL) throw("cannot open temp.dat");
     //Define the pdb file stuff
     string name = "ATOM"; string atom = "H"; string resname = "T3P"; string chainid = "C"; int resseq = 1; double occupancy = 0.0; double T = 0.0;
     fprintf (pFile, "%-6s%5i %-4s %3s %1s%4i    %8.3f%8.3f%8.3f%6.2f%6.2f\n", name.c_str(), pos/1000, "O", resname.c_str(), chainid.c_str(), 0, winner[0], winner[1], winner[2], occupancy, T);
@@ -765,13 +827,39 @@ void sixdimprob(string infile) {
     getline(input, stemp); 
     probout << stemp << endl;
 
-    delete dists;
-    delete winners;
     input.close();
     probout.close();
 }
 
 
+/*
+    Called from a catch (...) around code run with the GIL released: puts the message of the exception in flight
+    into msg and returns the Python exception to raise for it once the GIL is back. The repo's own errors are thrown
+    as strings and map to thrown; anything else the C++ runtime raises (bad_alloc from a big input, ...) must not
+    unwind through Py_END_ALLOW_THREADS either.
+*/
+static PyObject * cxxerror(string &msg, PyObject *thrown)
+{
+    try {
+        throw;
+    }
+    catch (const char *e) {
+        msg = e;
+        return thrown;
+    }
+    catch (const bad_alloc &) {
+        msg = "out of memory";
+        return PyExc_MemoryError;
+    }
+    catch (const exception &e) {
+        msg = e.what();
+    }
+    catch (...) {
+        msg = "unknown C++ exception";
+    }
+    return PyExc_RuntimeError;
+}
+
 static PyObject * _sstmap_entropy_runbruteclust(PyObject * self, PyObject * args)
 {
     char* clustercenter_file;
@@ -784,25 +872,382 @@ static PyObject * _sstmap_entropy_runbruteclust(PyObject * self, PyObject * args
         }
         string cfile (clustercenter_file);
         string wfile (within5Aofligand_file);
-        bruteclust(cfile, wfile);
+        //only files are touched from here on, other Python threads can run meanwhile
+        PyObject *err = NULL;
+        string errmsg;
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            bruteclust(cfile, wfile);
+        }
+        catch (...) {
+            err = cxxerror(errmsg, PyExc_RuntimeError);
+        }
+        Py_END_ALLOW_THREADS
+        if (err) {
+            PyErr_SetString(err, errmsg.c_str());
+            return NULL;
+        }
     return Py_BuildValue("i", 1);
 
 }
 
-static PyObject * _sstmap_entropy_runkdhsa102(PyObject * self, PyObject * args)
+static PyObject * entropy_values(const vector<double> &s)
 {
+    //a float for a single k, a tuple of one float per k otherwise
+    if (s.size() == 1) return PyFloat_FromDouble(s[0]);
+    PyObject *t = PyTuple_New(s.size());
+    for (int k = 0; k < s.size(); k++) PyTuple_SET_ITEM(t, k, PyFloat_FromDouble(s[k]));
+    return t;
+}
+
+static PyObject * _sstmap_entropy_runkdhsa102(PyObject * self, PyObject * args, PyObject * kwargs)
+{
+    /*
+        Returns the translational and orientational entropies of the site. With append (the default) they are also
+        added to trans.dat and orient.dat in the working directory, sites run from several threads at once should
+        pass append=0 and collect the return values instead.
+    */
     char* standard_cluster_file;
     char* expanded_cluster_file;
-    if (!PyArg_ParseTuple(args, "ss",
+    char* tree_file = NULL;
+    double eps = 0;
+    int single = KDSINGLE;
+    int kmax = 1;
+    int append = 1;
+    static char *kwlist[] = {(char *)"std_cluster_file", (char *)"exp_cluster_file", (char *)"tree_file",
+                             (char *)"eps", (char *)"single", (char *)"kmax", (char *)"append", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss|sdiii", kwlist,
                             &standard_cluster_file,
-                            &expanded_cluster_file))
+                            &expanded_cluster_file,
+                            &tree_file,
+                            &eps,
+                            &single,
+                            &kmax,
+                            &append))
         {
             return NULL; /* raise argument parsing exception*/
         }
         string std_cluster_file (standard_cluster_file);
         string exp_cluster_file (expanded_cluster_file);
-        kdhsa102(std_cluster_file, exp_cluster_file);
-    return Py_BuildValue("i", 1);
+        string trans_tree_file (tree_file ? tree_file : "");
+        if (kmax < 1) {
+            PyErr_SetString(PyExc_ValueError, "kmax must be at least 1");
+            return NULL;
+        }
+        vector<double> trans, orient;
+        PyObject *err = NULL;
+        string errmsg;
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            kdhsa102(std_cluster_file, exp_cluster_file, trans_tree_file, eps, single != 0, kmax, append != 0, trans,
+                     orient);
+        }
+        catch (...) {
+            err = cxxerror(errmsg, PyExc_RuntimeError);
+        }
+        Py_END_ALLOW_THREADS
+        if (err) {
+            PyErr_SetString(err, errmsg.c_str());
+            return NULL;
+        }
+    return Py_BuildValue("NN", entropy_values(trans), entropy_values(orient));
+
+}
+
+static int water_array(PyObject *obj, const char *name, vector<double> &waters)
+{
+    //copies an N x 3 x 3 array of O, H1 and H2 positions into waters, 9 doubles a water
+    PyArrayObject *arr = (PyArrayObject *) PyArray_FROMANY(obj, NPY_DOUBLE, 3, 3, NPY_ARRAY_IN_ARRAY);
+    if (arr == NULL) return 0;
+    if (PyArray_DIM(arr, 1) != 3 || PyArray_DIM(arr, 2) != 3) {
+        PyErr_Format(PyExc_ValueError, "%s must be an N x 3 x 3 array of water coordinates", name);
+        Py_DECREF(arr);
+        return 0;
+    }
+    const double *data = (const double *) PyArray_DATA(arr);
+    waters.assign(data, data + 9*PyArray_DIM(arr, 0));
+    Py_DECREF(arr);
+    return 1;
+}
+
+static int neighbour_arrays(npy_intp nwat, int kmax, PyObject *arrs[4], double *data[4])
+{
+    /*
+        The four per water arrays of the per_water option (translational distances and log terms, orientational
+        distances and log terms), nwat long with a column per k when kmax > 1 and filled with NaN. The entropy code
+        writes into their data directly.
+    */
+    npy_intp dims[2] = {nwat, kmax};
+    for (int q = 0; q < 4; q++) {
+        arrs[q] = PyArray_SimpleNew(kmax > 1 ? 2 : 1, dims, NPY_DOUBLE);
+        if (arrs[q] == NULL) {
+            for (int r = 0; r < q; r++) Py_DECREF(arrs[r]);
+            return 0;
+        }
+        data[q] = (double *) PyArray_DATA((PyArrayObject *) arrs[q]);
+        fill(data[q], data[q] + nwat*kmax, NAN);
+    }
+    return 1;
+}
+
+static PyObject * _sstmap_entropy_runsiteentropy(PyObject * self, PyObject * args, PyObject * kwargs)
+{
+    /*
+        Translational and orientational entropies of a site from the waters of its standard and expanded clusters,
+        N x 3 x 3 arrays of O, H1 and H2 positions, with no files read or written. With per_water set the
+        nearest neighbour distances and log terms behind the entropies are returned as well, (trans, orient,
+        trans_dist, trans_log, orient_dist, orient_log), one row per standard water.
+    */
+    PyObject *std_obj;
+    PyObject *exp_obj;
+    double eps = 0;
+    int single = KDSINGLE;
+    int kmax = 1;
+    int per_water = 0;
+    static char *kwlist[] = {(char *)"std_waters", (char *)"exp_waters", (char *)"eps", (char *)"single",
+                             (char *)"kmax", (char *)"per_water", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|diii", kwlist,
+                            &std_obj,
+                            &exp_obj,
+                            &eps,
+                            &single,
+                            &kmax,
+                            &per_water))
+        {
+            return NULL; /* raise argument parsing exception*/
+        }
+        if (kmax < 1) {
+            PyErr_SetString(PyExc_ValueError, "kmax must be at least 1");
+            return NULL;
+        }
+        vector<double> std_waters, exp_waters;
+        if (!water_array(std_obj, "std_waters", std_waters) || !water_array(exp_obj, "exp_waters", exp_waters))
+            return NULL;
+        PyObject *nn_arrs[4] = {NULL, NULL, NULL, NULL};
+        double *nn[4] = {NULL, NULL, NULL, NULL};
+        if (per_water && !neighbour_arrays(std_waters.size()/9, kmax, nn_arrs, nn)) return NULL;
+        vector<double> trans, orient;
+        PyObject *err = NULL;
+        string errmsg;
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            siteentropy(std_waters, exp_waters, eps, single != 0, kmax, trans, orient, NULL, nn[0], nn[1], nn[2],
+                        nn[3]);
+        }
+        catch (...) {
+            err = cxxerror(errmsg, PyExc_RuntimeError);
+        }
+        Py_END_ALLOW_THREADS
+        if (err) {
+            for (int q = 0; q < 4; q++) Py_XDECREF(nn_arrs[q]);
+            PyErr_SetString(err, errmsg.c_str());
+            return NULL;
+        }
+        if (per_water)
+            return Py_BuildValue("NNNNNN", entropy_values(trans), entropy_values(orient), nn_arrs[0], nn_arrs[1],
+                                 nn_arrs[2], nn_arrs[3]);
+    return Py_BuildValue("NN", entropy_values(trans), entropy_values(orient));
+
+}
+
+static int offset_array(PyObject *obj, const char *name, vector<long> &offsets)
+{
+    //copies the site offsets of a CSR layout, one more than there are sites
+    PyArrayObject *arr = (PyArrayObject *) PyArray_FROMANY(obj, NPY_LONG, 1, 1, NPY_ARRAY_IN_ARRAY);
+    if (arr == NULL) return 0;
+    if (PyArray_DIM(arr, 0) < 1) {
+        PyErr_Format(PyExc_ValueError, "%s must hold one offset more than there are sites", name);
+        Py_DECREF(arr);
+        return 0;
+    }
+    const long *data = (const long *) PyArray_DATA(arr);
+    offsets.assign(data, data + PyArray_DIM(arr, 0));
+    Py_DECREF(arr);
+    return 1;
+}
+
+static PyObject * double_array(const vector<double> &vals, int nd, npy_intp *dims)
+{
+    PyArrayObject *arr = (PyArrayObject *) PyArray_SimpleNew(nd, dims, NPY_DOUBLE);
+    if (arr == NULL) return NULL;
+    if (!vals.empty()) memcpy(PyArray_DATA(arr), &vals[0], vals.size()*sizeof(double));
+    return (PyObject *) arr;
+}
+
+static PyObject * _sstmap_entropy_runsiteentropies(PyObject * self, PyObject * args, PyObject * kwargs)
+{
+    /*
+        Entropies and most probable configurations of all sites in one call. The waters of the standard clusters
+        are one M x 3 x 3 array, those of site i being std_waters[std_offsets[i]:std_offsets[i + 1]], and the same
+        for the expanded clusters. Returns (trans, orient, probable, seconds): the entropies (one column per k when
+        kmax > 1), an n_sites x 3 x 3 array of probable configurations and the time spent on each site. Sites that
+        fail get NaNs. per_water adds the arrays of run_site_entropy, (..., seconds, trans_dist, trans_log,
+        orient_dist, orient_log), with the rows of std_waters.
+    */
+    PyObject *std_obj, *std_off_obj;
+    PyObject *exp_obj, *exp_off_obj;
+    double eps = 0;
+    int single = KDSINGLE;
+    int kmax = 1;
+    int n_threads = 0;
+    int per_water = 0;
+    static char *kwlist[] = {(char *)"std_waters", (char *)"std_offsets", (char *)"exp_waters",
+                             (char *)"exp_offsets", (char *)"eps", (char *)"single", (char *)"kmax",
+                             (char *)"n_threads", (char *)"per_water", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|diiii", kwlist,
+                            &std_obj,
+                            &std_off_obj,
+                            &exp_obj,
+                            &exp_off_obj,
+                            &eps,
+                            &single,
+                            &kmax,
+                            &n_threads,
+                            &per_water))
+        {
+            return NULL; /* raise argument parsing exception*/
+        }
+        if (kmax < 1) {
+            PyErr_SetString(PyExc_ValueError, "kmax must be at least 1");
+            return NULL;
+        }
+        vector<double> std_waters, exp_waters;
+        vector<long> std_offsets, exp_offsets;
+        if (!water_array(std_obj, "std_waters", std_waters) || !offset_array(std_off_obj, "std_offsets", std_offsets)
+            || !water_array(exp_obj, "exp_waters", exp_waters)
+            || !offset_array(exp_off_obj, "exp_offsets", exp_offsets))
+            return NULL;
+        PyObject *nn_arrs[4] = {NULL, NULL, NULL, NULL};
+        double *nn[4] = {NULL, NULL, NULL, NULL};
+        if (per_water && !neighbour_arrays(std_waters.size()/9, kmax, nn_arrs, nn)) return NULL;
+        vector<double> trans, orient, probable, seconds;
+        PyObject *err = NULL;
+        string errmsg;
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            siteentropies(std_waters, std_offsets, exp_waters, exp_offsets, eps, single != 0, kmax, n_threads, trans,
+                          orient, probable, seconds, nn[0], nn[1], nn[2], nn[3]);
+        }
+        catch (...) {
+            err = cxxerror(errmsg, PyExc_ValueError);
+        }
+        Py_END_ALLOW_THREADS
+        if (err) {
+            for (int q = 0; q < 4; q++) Py_XDECREF(nn_arrs[q]);
+            PyErr_SetString(err, errmsg.c_str());
+            return NULL;
+        }
+        npy_intp nsites = seconds.size();
+        npy_intp ent_dims[2] = {nsites, kmax};
+        npy_intp prob_dims[3] = {nsites, 3, 3};
+        PyObject *trans_arr = double_array(trans, kmax > 1 ? 2 : 1, ent_dims);
+        PyObject *orient_arr = double_array(orient, kmax > 1 ? 2 : 1, ent_dims);
+        PyObject *prob_arr = double_array(probable, 3, prob_dims);
+        PyObject *sec_arr = double_array(seconds, 1, &nsites);
+        if (!trans_arr || !orient_arr || !prob_arr || !sec_arr) {
+            Py_XDECREF(trans_arr);
+            Py_XDECREF(orient_arr);
+            Py_XDECREF(prob_arr);
+            Py_XDECREF(sec_arr);
+            for (int q = 0; q < 4; q++) Py_XDECREF(nn_arrs[q]);
+            return NULL;
+        }
+        if (per_water)
+            return Py_BuildValue("NNNNNNNN", trans_arr, orient_arr, prob_arr, sec_arr, nn_arrs[0], nn_arrs[1],
+                                 nn_arrs[2], nn_arrs[3]);
+    return Py_BuildValue("NNNN", trans_arr, orient_arr, prob_arr, sec_arr);
+
+}
+
+static int frame_array(PyObject *obj, const char *name, vector<int> &frames)
+{
+    //copies the frame index of every water, read as long like the offsets so that any integer array converts
+    PyArrayObject *arr = (PyArrayObject *) PyArray_FROMANY(obj, NPY_LONG, 1, 1, NPY_ARRAY_IN_ARRAY);
+    if (arr == NULL) return 0;
+    const long *data = (const long *) PyArray_DATA(arr);
+    frames.resize(PyArray_DIM(arr, 0));
+    for (npy_intp i = 0; i < PyArray_DIM(arr, 0); i++) {
+        if (data[i] < 0 || data[i] > INT_MAX) {
+            PyErr_Format(PyExc_ValueError, "%s holds a frame out of range", name);
+            Py_DECREF(arr);
+            return 0;
+        }
+        frames[i] = data[i];
+    }
+    Py_DECREF(arr);
+    return 1;
+}
+
+static PyObject * _sstmap_entropy_runsiteconvergence(PyObject * self, PyObject * args, PyObject * kwargs)
+{
+    /*
+        Entropies of all sites over windows of the trajectory, in one sweep. The waters and offsets are those of
+        run_site_entropies, std_frames and exp_frames the frame of every water, 0..n_frames-1. Returns
+        (block_trans, block_orient, prefix_trans, prefix_orient), n_sites x n_blocks arrays: the entropies of
+        each of n_blocks consecutive blocks of frames and of the growing prefixes, blocks 0..j, the last prefix
+        being the whole trajectory. Windows without waters and sites that fail get NaNs.
+    */
+    PyObject *std_obj, *std_frame_obj, *std_off_obj;
+    PyObject *exp_obj, *exp_frame_obj, *exp_off_obj;
+    int n_frames;
+    int n_blocks = 10;
+    double eps = 0;
+    int single = KDSINGLE;
+    int n_threads = 0;
+    static char *kwlist[] = {(char *)"std_waters", (char *)"std_frames", (char *)"std_offsets",
+                             (char *)"exp_waters", (char *)"exp_frames", (char *)"exp_offsets", (char *)"n_frames",
+                             (char *)"n_blocks", (char *)"eps", (char *)"single", (char *)"n_threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOi|idii", kwlist,
+                            &std_obj,
+                            &std_frame_obj,
+                            &std_off_obj,
+                            &exp_obj,
+                            &exp_frame_obj,
+                            &exp_off_obj,
+                            &n_frames,
+                            &n_blocks,
+                            &eps,
+                            &single,
+                            &n_threads))
+        {
+            return NULL; /* raise argument parsing exception*/
+        }
+        vector<double> std_waters, exp_waters;
+        vector<int> std_frames, exp_frames;
+        vector<long> std_offsets, exp_offsets;
+        if (!water_array(std_obj, "std_waters", std_waters) || !frame_array(std_frame_obj, "std_frames", std_frames)
+            || !offset_array(std_off_obj, "std_offsets", std_offsets)
+            || !water_array(exp_obj, "exp_waters", exp_waters)
+            || !frame_array(exp_frame_obj, "exp_frames", exp_frames)
+            || !offset_array(exp_off_obj, "exp_offsets", exp_offsets))
+            return NULL;
+        vector<double> btrans, borient, ptrans, porient;
+        PyObject *err = NULL;
+        string errmsg;
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            siteconvergences(std_waters, std_frames, std_offsets, exp_waters, exp_frames, exp_offsets, n_frames,
+                             n_blocks, eps, single != 0, n_threads, btrans, borient, ptrans, porient);
+        }
+        catch (...) {
+            err = cxxerror(errmsg, PyExc_ValueError);
+        }
+        Py_END_ALLOW_THREADS
+        if (err) {
+            PyErr_SetString(err, errmsg.c_str());
+            return NULL;
+        }
+        npy_intp dims[2] = {(npy_intp) std_offsets.size() - 1, n_blocks};
+        PyObject *arrs[4];
+        const vector<double> *vals[4] = {&btrans, &borient, &ptrans, &porient};
+        for (int q = 0; q < 4; q++) {
+            arrs[q] = double_array(*vals[q], 2, dims);
+            if (arrs[q] == NULL) {
+                for (int r = 0; r < q; r++) Py_DECREF(arrs[r]);
+                return NULL;
+            }
+        }
+    return Py_BuildValue("NNNN", arrs[0], arrs[1], arrs[2], arrs[3]);
 
 }
 
@@ -814,8 +1259,22 @@ static PyObject * _sstmap_entropy_run6dimprob(PyObject * self, PyObject * args)
         {
             return NULL; /* raise argument parsing exception*/
         }
-        //string std_cluster_file (standard_cluster_file);
-        //sixdimprob(std_cluster_file);
+        string std_cluster_file (standard_cluster_file);
+        //only files are touched from here on, other Python threads can run meanwhile
+        PyObject *err = NULL;
+        string errmsg;
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            sixdimprob(std_cluster_file);
+        }
+        catch (...) {
+            err = cxxerror(errmsg, PyExc_RuntimeError);
+        }
+        Py_END_ALLOW_THREADS
+        if (err) {
+            PyErr_SetString(err, errmsg.c_str());
+            return NULL;
+        }
     return Py_BuildValue("i", 1);
 
 }
@@ -833,9 +1292,30 @@ static PyMethodDef _sstmap_entropy_methods[] = {
     {
         "run_kdhsa102",
         (PyCFunction)_sstmap_entropy_runkdhsa102,
-        METH_VARARGS,
+        METH_VARARGS | METH_KEYWORDS,
         "Run kdhsa102"
 
+    },
+    {
+        "run_site_entropy",
+        (PyCFunction)_sstmap_entropy_runsiteentropy,
+        METH_VARARGS | METH_KEYWORDS,
+        "Run kdhsa102 on water coordinate arrays"
+
+    },
+    {
+        "run_site_entropies",
+        (PyCFunction)_sstmap_entropy_runsiteentropies,
+        METH_VARARGS | METH_KEYWORDS,
+        "Run kdhsa102 and probable configs on all sites at once"
+
+    },
+    {
+        "run_site_convergence",
+        (PyCFunction)_sstmap_entropy_runsiteconvergence,
+        METH_VARARGS | METH_KEYWORDS,
+        "Run block and prefix entropies of all sites"
+
     },
     {
         "run_6dimprob",
@@ -874,6 +1354,8 @@ MOD_INIT(_sstmap_entropy)
                     
         if (m == NULL)
             return MOD_ERROR_VAL;
+
+        import_array();
         
         return MOD_SUCCESS_VAL(m);
 }
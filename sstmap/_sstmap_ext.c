@@ -38,6 +38,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <gsl/gsl_linalg.h>
+#include "vptree.h"
+#include "waterorient.h"
 
 
 void invert_matrix(float *matrix){
@@ -232,6 +234,8 @@ PyObject *_sstmap_ext_assign_voxels(PyObject *self, PyObject *args)
     PyArrayObject *wat_data;
     PyObject *curr_voxel;
     int voxel_id;
+    int *hits; // voxel and water ID of every water found on the grid, appended to frame_data once the GIL is back
+    int n_hits = 0, i_hit;
 
     if (!PyArg_ParseTuple(args, "O!O!O!O!O!O!",
         &PyArray_Type, &coords,
@@ -262,12 +266,14 @@ PyObject *_sstmap_ext_assign_voxels(PyObject *self, PyObject *args)
     grid_dim_y = *(int *)PyArray_GETPTR1(grid_dim, 1);
     grid_dim_z = *(int *)PyArray_GETPTR1(grid_dim, 2);
 
+    hits = (int *) malloc(2 * (size_t) (n_frames * n_wat > 0 ? n_frames * n_wat : 1) * sizeof(int));
+    if (hits == NULL) return PyErr_NoMemory();
+    Py_BEGIN_ALLOW_THREADS
     for (i_frame = 0; i_frame < n_frames; i_frame++)
     {
         //printf("Iterating over frame: %i\n", i_frame);
         for (i_wat = 0; i_wat < n_wat; i_wat++)
         {
-            dims[0] = 2;
             // get water ID to and use it to get x, y, z coordinates and vdw params
             wat_id = *(int *) PyArray_GETPTR1(wat_oxygen_ids, i_wat); // obtain atom index for this atom
             wat_x = (float *) PyArray_GETPTR3(coords, i_frame, wat_id, 0);
@@ -296,18 +302,27 @@ PyObject *_sstmap_ext_assign_voxels(PyObject *self, PyObject *args)
                         voxel_id = (grid_index_x*grid_dim_y + grid_index_y)*grid_dim_z + grid_index_z;
                         //voxel_ = (gridindex[0]*griddim_[1] + gridindex[1])*griddim_[2] + gridindex[2];
                         //printf("Water atom ID %i with coordinates %f %f %f assigned to voxel %i.\n", wat_id, *wat_x, *wat_y, *wat_z, voxel_id);
-                        wat_data = (PyArrayObject *) PyArray_FromDims(1, dims, NPY_INT);
-                        *(int *)PyArray_GETPTR1(wat_data, 0) = voxel_id;
-                        *(int *)PyArray_GETPTR1(wat_data, 1) = wat_id;
-                        //printf("wat_data: %d %d %d\n", voxel_id, *(int *)PyArray_GETPTR1(wat_data, 0), *(int *)PyArray_GETPTR1(wat_data, 1));
-                        //curr_voxel = PyList_GetItem(frame_data, i_frame);
-                        PyList_Append(frame_data, wat_data);
-                        //DECREF?
+                        hits[2 * n_hits] = voxel_id;
+                        hits[2 * n_hits + 1] = wat_id;
+                        n_hits++;
                     }
                 }
             }
         } // finish iterating over waters
     }
+    Py_END_ALLOW_THREADS
+    dims[0] = 2;
+    for (i_hit = 0; i_hit < n_hits; i_hit++)
+    {
+        wat_data = (PyArrayObject *) PyArray_FromDims(1, dims, NPY_INT);
+        *(int *)PyArray_GETPTR1(wat_data, 0) = hits[2 * i_hit];
+        *(int *)PyArray_GETPTR1(wat_data, 1) = hits[2 * i_hit + 1];
+        //printf("wat_data: %d %d %d\n", voxel_id, *(int *)PyArray_GETPTR1(wat_data, 0), *(int *)PyArray_GETPTR1(wat_data, 1));
+        //curr_voxel = PyList_GetItem(frame_data, i_frame);
+        PyList_Append(frame_data, wat_data);
+        //DECREF?
+    }
+    free(hits);
     return Py_BuildValue("i", 1);
 }
 
@@ -334,6 +349,8 @@ PyObject *_sstmap_ext_get_pairwise_distances(PyObject *self, PyObject *args)
     {
         return NULL;
     }
+    // the arrays are only read and written through their data pointers, the GIL is not needed from here on
+    Py_BEGIN_ALLOW_THREADS
     // do distance calc here
         // retrieve unit cell lengths for this frame
     uc_vec[0] = *(float *) PyArray_GETPTR2(uc, 0, 0);
@@ -402,6 +419,7 @@ PyObject *_sstmap_ext_get_pairwise_distances(PyObject *self, PyObject *args)
         }
 
     }
+    Py_END_ALLOW_THREADS
     return Py_BuildValue("i", 1);
 
 }
@@ -421,6 +439,7 @@ PyObject *_sstmap_ext_getNNOrEntropy(PyObject *self, PyObject *args)
         {
             return NULL; /* raise argument parsing exception*/
         }
+    Py_BEGIN_ALLOW_THREADS
     // for each water in the voxel
     for (n = 0; n < nwtot; n++){
         NNor = 10000;
@@ -450,6 +469,7 @@ PyObject *_sstmap_ext_getNNOrEntropy(PyObject *self, PyObject *args)
             voxel_dTSor += wat_or_ent;            
         }        
     }
+    Py_END_ALLOW_THREADS
     // 
     //*(double *)PyArray_GETPTR1(ent, 2) += voxel_dTSor_norm;
     return Py_BuildValue("f", voxel_dTSor);
@@ -476,8 +496,9 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
     unsigned int voxel;
     PyArrayObject *voxel_data, *grid_dims;
     PyObject *voxel_O_coords, *voxel_quarts;
+    int exact_six = 0;
     // Argument parsing to reterive everything sent from Python correctly
-    if (!PyArg_ParseTuple(args, "ifffO!O!O!O!",
+    if (!PyArg_ParseTuple(args, "ifffO!O!O!O!|i",
                             &num_frames,
                             &voxel_vol,
                             &ref_dens,
@@ -485,7 +506,8 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                             &PyArray_Type, &grid_dims,
                             &PyArray_Type, &voxel_data,
                             &PyList_Type, &voxel_O_coords,
-                            &PyList_Type, &voxel_quarts))
+                            &PyList_Type, &voxel_quarts,
+                            &exact_six))
         {
             return NULL; /* raise argument parsing exception*/
         }
@@ -497,6 +519,60 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
     unsigned int addx = ny * nz;
     unsigned int addy = nz;
     unsigned int addz = 1;
+    /* The oxygen coordinates and quaternions of the voxel lists are copied into one array first, 7 doubles a water,
+       wat_start[voxel] is the index of the first water of voxel. The rest of the calculation touches no Python
+       objects and runs without the GIL.
+       With exact_six the six-D nearest neighbour of each water is searched among all waters of the grid in a
+       vantage point tree (vptree.h), with q and -q taken as the same orientation, instead of among the waters of
+       the voxel and its neighbours only.
+    */
+    vptree *six_tree = NULL;
+    int *wat_start = NULL;
+    double *wat_conf = NULL;
+    int nconf = 0;
+    wat_start = (int *) malloc((max_voxel_index + 1) * sizeof(int));
+    if (wat_start == NULL) return PyErr_NoMemory();
+    for (voxel = 0; voxel < max_voxel_index; voxel++)
+    {
+        wat_start[voxel] = nconf;
+        nconf += (int) *(double *)PyArray_GETPTR2(voxel_data, voxel, 4);
+    }
+    wat_start[max_voxel_index] = nconf;
+    wat_conf = (double *) malloc(7 * (size_t) (nconf > 0 ? nconf : 1) * sizeof(double));
+    if (wat_conf == NULL)
+    {
+        free(wat_start);
+        return PyErr_NoMemory();
+    }
+    for (voxel = 0; voxel < max_voxel_index; voxel++)
+    {
+        PyObject *coords = PyList_GetItem(voxel_O_coords, voxel);
+        PyObject *quarts = PyList_GetItem(voxel_quarts, voxel);
+        for (n0 = 0; n0 < wat_start[voxel + 1] - wat_start[voxel]; n0++)
+        {
+            double *c = &wat_conf[7 * (wat_start[voxel] + n0)];
+            int k;
+            for (k = 0; k < 3; k++) c[k] = PyFloat_AsDouble(PyList_GetItem(coords, 3 * n0 + k));
+            for (k = 0; k < 4; k++) c[3 + k] = PyFloat_AsDouble(PyList_GetItem(quarts, 4 * n0 + k));
+        }
+    }
+    if (PyErr_Occurred())
+    {
+        free(wat_start);
+        free(wat_conf);
+        return NULL;
+    }
+    if (exact_six)
+    {
+        six_tree = vptree_build(wat_conf, nconf, 1);
+        if (six_tree == NULL)
+        {
+            free(wat_start);
+            free(wat_conf);
+            return PyErr_NoMemory();
+        }
+    }
+    Py_BEGIN_ALLOW_THREADS
     //PyObject *curr_voxel_coords;
     //PyObject *curr_voxel_quarts;
     //printf("grid dims: %i %i %i frames\n", nx, ny, nz);
@@ -513,53 +589,34 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
 
         *(double *) PyArray_GETPTR2(voxel_data, voxel, 5) += voxel_dens / ref_dens;
         //printf("DEBUG2 voxel %d gO %g rho %g occ %g\n", voxel, voxel_dens/ref_dens, ref_dens, voxel_dens);
-        PyObject *curr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel);
-        PyObject *curr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel);
+        const double *curr_conf = &wat_conf[7 * wat_start[voxel]];
         for (n0 = 0; n0 < (int) nw_total; n0++)
         {
               double NNd = 10000;
               double NNs = 10000;
               double NNr = 10000;
-              int i0 = n0 * 3; // index over O coordinates
-              int q0 = n0 * 4; // index over quar
 
               // access oxygen coordinates
-              PyObject *VX0 = PyList_GetItem(curr_voxel_coords, i0);
-              double vx0 = PyFloat_AsDouble(VX0);
-              PyObject *VY0 = PyList_GetItem(curr_voxel_coords, i0 + 1);
-              double vy0 = PyFloat_AsDouble(VY0);
-              PyObject *VZ0 = PyList_GetItem(curr_voxel_coords, i0 + 2);
-              double vz0 = PyFloat_AsDouble(VZ0);
+              double vx0 = curr_conf[7 * n0 + 0];
+              double vy0 = curr_conf[7 * n0 + 1];
+              double vz0 = curr_conf[7 * n0 + 2];
               // access quaternions
-              PyObject *QW0 = PyList_GetItem(curr_voxel_quarts, q0);
-              double qw0 = PyFloat_AsDouble(QW0);
-              PyObject *QX0 = PyList_GetItem(curr_voxel_quarts, q0 + 1);
-              double qx0 = PyFloat_AsDouble(QX0);
-              PyObject *QY0 = PyList_GetItem(curr_voxel_quarts, q0 + 2);
-              double qy0 = PyFloat_AsDouble(QY0);
-              PyObject *QZ0 = PyList_GetItem(curr_voxel_quarts, q0 + 3);
-              double qz0 = PyFloat_AsDouble(QZ0);
+              double qw0 = curr_conf[7 * n0 + 3];
+              double qx0 = curr_conf[7 * n0 + 4];
+              double qy0 = curr_conf[7 * n0 + 5];
+              double qz0 = curr_conf[7 * n0 + 6];
               for (n1 = 0; n1 < (int) nw_total; n1++)
               if ( n1 != n0)
               {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(curr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(curr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(curr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = curr_conf[7 * n1 + 0];
+                  double vy1 = curr_conf[7 * n1 + 1];
+                  double vz1 = curr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(curr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(curr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(curr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(curr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = curr_conf[7 * n1 + 3];
+                  double qx1 = curr_conf[7 * n1 + 4];
+                  double qy1 = curr_conf[7 * n1 + 5];
+                  double qz1 = curr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -597,34 +654,24 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
               //TODO: Replace this massive code repetition with a reusable function
               if (!boundary)
               {
-                PyObject *nbr_voxel_coords, *nbr_voxel_quarts;
+                const double *nbr_conf;
                 double n1_total;
                 /* Iterate over neighbor voxel in +Z direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addz, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addz);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addz);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addz]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -640,29 +687,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +Y direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addy, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addy);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addy);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addy]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -678,29 +715,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -716,29 +743,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in -Z direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel - addz, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel - addz);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel - addz);
+                nbr_conf = &wat_conf[7 * wat_start[voxel - addz]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -754,29 +771,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in -Y direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel - addy, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel - addy);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel - addy);
+                nbr_conf = &wat_conf[7 * wat_start[voxel - addy]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -792,29 +799,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in -X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel - addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel - addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel - addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel - addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -830,29 +827,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +Z +Y direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addz + addy, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addz + addy);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addz + addy);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addz + addy]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -868,29 +855,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +Z -Y direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addz - addy, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addz - addy);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addz - addy);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addz - addy]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -906,29 +883,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +Z +Y direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addz + addy, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addz + addy);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addz + addy);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addz + addy]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -944,29 +911,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +Z -Y direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addz - addy, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addz - addy);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addz - addy);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addz - addy]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -982,29 +939,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in -Z +Y direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel - addz + addy, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel - addz + addy);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel - addz + addy);
+                nbr_conf = &wat_conf[7 * wat_start[voxel - addz + addy]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1020,29 +967,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in -Z -Y direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel - addz - addy, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel - addz - addy);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel - addz - addy);
+                nbr_conf = &wat_conf[7 * wat_start[voxel - addz - addy]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1058,29 +995,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +Z +X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addz + addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addz + addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addz + addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addz + addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1096,29 +1023,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +Z -X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addz - addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addz - addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addz - addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addz - addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1134,29 +1051,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in -Z +X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel - addz + addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel - addz + addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel - addz + addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel - addz + addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1172,29 +1079,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in -Z -X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel - addz - addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel - addz - addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel - addz - addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel - addz - addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1210,29 +1107,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +Y +X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addy + addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addy + addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addy + addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addy + addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1248,29 +1135,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in +Y -X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel + addy - addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel + addy - addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel + addy - addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel + addy - addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1286,29 +1163,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in -Y +X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel - addy + addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel - addy + addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel - addy + addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel - addy + addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1324,29 +1191,19 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
                 /* Iterate over neighbor voxel in -Y -X direction
                 */
                 n1_total = *(double *)PyArray_GETPTR2(voxel_data, voxel - addy - addx, 4);
-                nbr_voxel_coords = PyList_GetItem(voxel_O_coords, voxel - addy - addx);
-                nbr_voxel_quarts = PyList_GetItem(voxel_quarts, voxel - addy - addx);
+                nbr_conf = &wat_conf[7 * wat_start[voxel - addy - addx]];
 
                 for (n1 = 0; n1 != (int)n1_total; n1++)
                 {
                   // access oxygen coordinates
-                  int i1 = n1 * 3; // index over O coordinates
-                  int q1 = n1 * 4; // index over quar
-                  PyObject *VX1 = PyList_GetItem(nbr_voxel_coords, i1);
-                  double vx1 = PyFloat_AsDouble(VX1);
-                  PyObject *VY1 = PyList_GetItem(nbr_voxel_coords, i1 + 1);
-                  double vy1 = PyFloat_AsDouble(VY1);
-                  PyObject *VZ1 = PyList_GetItem(nbr_voxel_coords, i1 + 2);
-                  double vz1 = PyFloat_AsDouble(VZ1);
+                  double vx1 = nbr_conf[7 * n1 + 0];
+                  double vy1 = nbr_conf[7 * n1 + 1];
+                  double vz1 = nbr_conf[7 * n1 + 2];
                   // access quaternions
-                  PyObject *QW1 = PyList_GetItem(nbr_voxel_quarts, q1);
-                  double qw1 = PyFloat_AsDouble(QW1);
-                  PyObject *QX1 = PyList_GetItem(nbr_voxel_quarts, q1 + 1);
-                  double qx1 = PyFloat_AsDouble(QX1);
-                  PyObject *QY1 = PyList_GetItem(nbr_voxel_quarts, q1 + 2);
-                  double qy1 = PyFloat_AsDouble(QY1);
-                  PyObject *QZ1 = PyList_GetItem(nbr_voxel_quarts, q1 + 3);
-                  double qz1 = PyFloat_AsDouble(QZ1);
+                  double qw1 = nbr_conf[7 * n1 + 3];
+                  double qx1 = nbr_conf[7 * n1 + 4];
+                  double qy1 = nbr_conf[7 * n1 + 5];
+                  double qz1 = nbr_conf[7 * n1 + 6];
 
                   double dd = dist_squared(vx0, vy0, vz0, vx1, vy1, vz1);
                   if (dd < NNd && dd > 0) { NNd = dd; }
@@ -1362,6 +1219,11 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
 
                 NNd = sqrt(NNd);
                 NNs = sqrt(NNs);
+                if (six_tree != NULL)
+                {
+                    int it = wat_start[voxel] + n0;
+                    NNs = vptree_nearest(six_tree, &wat_conf[7 * it], it, NULL);
+                }
 
                 if (NNd < 3 && NNd > 0)
                 {
@@ -1419,6 +1281,10 @@ PyObject *_sstmap_ext_getNNTrEntropy(PyObject *self, PyObject *args)
     printf("Total 6d if all one vox: %9.5f kcal/mol\n", dTSst);
     printf("Total t if all one vox: %9.5f kcal/mol\n", dTStt);
     printf("Total o if all one vox: %9.5f kcal/mol\n", dTSot);
+    vptree_free(six_tree);
+    free(wat_start);
+    free(wat_conf);
+    Py_END_ALLOW_THREADS
 
 
 
@@ -1441,6 +1307,7 @@ PyObject *_sstmap_ext_get_dist_matrix(PyObject *self, PyObject *args)
         {
             return NULL; /* raise argument parsing exception*/
         }
+    Py_BEGIN_ALLOW_THREADS
     // for each water in the voxel
     for (n = 0; n < nwtot; n++)
     {
@@ -1459,6 +1326,7 @@ PyObject *_sstmap_ext_get_dist_matrix(PyObject *self, PyObject *args)
             *(double *)PyArray_GETPTR2(dist_matrix, n, l) = dR;
         }
     }
+    Py_END_ALLOW_THREADS
     return Py_BuildValue("i", 1);
 }
 
@@ -1485,6 +1353,7 @@ PyObject *_sstmap_ext_calculate_energy(PyObject *self, PyObject *args)
     //printf("The number of solvent atoms = %i\n", solvent_at_sites);
     //printf("The number of target atoms  = %i\n", n_atoms);
 
+    Py_BEGIN_ALLOW_THREADS
     // for each water in the voxel
     for (i = 0; i < solvent_at_sites; i++)
     {
@@ -1515,12 +1384,62 @@ PyObject *_sstmap_ext_calculate_energy(PyObject *self, PyObject *args)
             //}
         }
     }
+    Py_END_ALLOW_THREADS
 
     return Py_BuildValue("i", 1);
 
 }
 
 
+PyObject *_sstmap_ext_water_orientations(PyObject *self, PyObject *args)
+{
+    /*
+        Orientation quaternions (N x 4, w x y z) of the N waters in an N x 3 x 3 coordinate block (O H1 H2 of each
+        water), and with euler set the Euler angles (N x 3) as well, returned as a tuple.
+    */
+    PyObject *obj;
+    PyArrayObject *waters, *quat, *euler = NULL;
+    int want_euler = 0, n;
+    npy_intp dims[2];
+
+    if (!PyArg_ParseTuple(args, "O|i", &obj, &want_euler))
+        {
+            return NULL; /* raise argument parsing exception*/
+        }
+    waters = (PyArrayObject *) PyArray_FROMANY(obj, NPY_DOUBLE, 3, 3, NPY_ARRAY_IN_ARRAY);
+    if (waters == NULL) return NULL;
+    if (PyArray_DIM(waters, 1) != 3 || PyArray_DIM(waters, 2) != 3)
+    {
+        Py_DECREF(waters);
+        PyErr_SetString(PyExc_ValueError, "waters must be an N x 3 x 3 array");
+        return NULL;
+    }
+    n = (int) PyArray_DIM(waters, 0);
+    dims[0] = n;
+    dims[1] = 4;
+    quat = (PyArrayObject *) PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (want_euler)
+    {
+        dims[1] = 3;
+        euler = (PyArrayObject *) PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    }
+    if (quat == NULL || (want_euler && euler == NULL))
+    {
+        Py_DECREF(waters);
+        Py_XDECREF(quat);
+        Py_XDECREF(euler);
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    waterorient((double *) PyArray_DATA(waters), n, (double *) PyArray_DATA(quat),
+                want_euler ? (double *) PyArray_DATA(euler) : NULL);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(waters);
+
+    if (want_euler) return Py_BuildValue("NN", quat, euler);
+    return (PyObject *) quat;
+}
+
 /* Method Table
  * Registering all the functions that will be called from Python
  */
@@ -1565,6 +1484,12 @@ static PyMethodDef _sstmap_ext_methods[] = {
         METH_VARARGS,
         "get voxel entropy"
     },
+    {
+        "water_orientations",
+        (PyCFunction)_sstmap_ext_water_orientations,
+        METH_VARARGS,
+        "get water orientation quaternions"
+    },
     {NULL, NULL, 0, NULL}
 };
 
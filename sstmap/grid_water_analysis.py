@@ -184,95 +184,31 @@ class GridWaterAnalysis(WaterAnalysis):
         coords : numpy.ndarray
             An array of x, y, z coordinates corresponding to atom positions in current frame.
         """
-        # define the lab frame of reference
-        xlab = np.asarray([1.0, 0.0, 0.0])
-        zlab = np.asarray([0.0, 0.0, 1.0])
-        # create array for water oxygen atom coords, and append to this voxel's
-        voxel_id = water[0]
-        owat = coords[water[1], :]
-        # create array for water's hydrogen 1 and 2
-        h1wat = coords[water[1] + 1, :] - owat
-        h2wat = coords[water[1] + 2, :] - owat
-        # print frame_index, wat_O, owat, h1wat, h2wat
-        # define water molecule's frame
-        # H1 is water's x-axis, should be normalized
-        h1wat /= np.linalg.norm(h1wat)
-        h2wat /= np.linalg.norm(h2wat)
-        ar1 = np.cross(h1wat, xlab)
-        sar = np.copy(ar1)
-        ar1 /= np.linalg.norm(ar1)
-        dp1 = np.sum(xlab * h1wat)
-        theta = np.arccos(dp1)
-        sign = np.sum(sar * h1wat)
-        if sign > 0:
-            theta /= 2.0
-        else:
-            theta /= -2.0
-
-        w1 = np.cos(theta)
-        sin_theta = np.sin(theta)
-        x1 = ar1[0] * sin_theta
-        y1 = ar1[1] * sin_theta
-        z1 = ar1[2] * sin_theta
-        w2 = w1
-        x2 = x1
-        y2 = y1
-        z2 = z1
-
-        H_temp = np.zeros(3)
-        H_temp[0] = ((w2*w2+x2*x2)-(y2*y2+z2*z2))*h1wat[0]
-        H_temp[0] = (2*(x2*y2 - w2*z2)*h1wat[1]) + H_temp[0]
-        H_temp[0] = (2*(x2*z2-w2*y2)*h1wat[2]) + H_temp[0]
-
-        H_temp[1] = 2*(x2*y2 - w2*z2)* h1wat[0]
-        H_temp[1] = ((w2*w2-x2*x2+y2*y2-z2*z2)*h1wat[1]) + H_temp[1]
-        H_temp[1] = (2*(y2*z2+w2*x2)*h1wat[2]) +H_temp[1]
-
-        H_temp[2] = 2*(x2*z2+w2*y2) * h1wat[0]
-        H_temp[2] = (2*(y2*z2-w2*x2)*h1wat[1]) + H_temp[2]
-        H_temp[2] = ((w2*w2-x2*x2-y2*y2+z2*z2)*h1wat[2]) + H_temp[2]
-
-        H_temp2 = np.zeros(3,)
-        H_temp2[0] = ((w2*w2+x2*x2)-(y2*y2+z2*z2))*h2wat[0]
-        H_temp2[0] = (2*(x2*y2 + w2*z2)*h2wat[1]) + H_temp2[0]
-        H_temp2[0] = (2*(x2*z2-w2*y2)+h2wat[2]) +H_temp2[0]
-
-        H_temp2[1] = 2*(x2*y2 - w2*z2) *h2wat[0]
-        H_temp2[1] = ((w2*w2-x2*x2+y2*y2-z2*z2)*h2wat[1]) +H_temp2[1]
-        H_temp2[1] = (2*(y2*z2+w2*x2)*h2wat[2]) +H_temp2[1]
-
-        H_temp2[2] = 2*(x2*z2+w2*y2)*h2wat[0]
-        H_temp2[2] = (2*(y2*z2-w2*x2)*h2wat[1]) +H_temp2[2]
-        H_temp2[2] = ((w2*w2-x2*x2-y2*y2+z2*z2)*h2wat[2]) + H_temp2[2]
-
-        ar2 = np.cross(H_temp, H_temp2)
-        ar2 /= np.linalg.norm(ar2)
-        dp2 = np.sum(ar2 * zlab)
-        theta = np.arccos(dp2)
-
-        sar = np.cross(ar2, zlab)
-        sign = np.sum(sar * H_temp)
-
-        if sign < 0:
-          theta /= 2.0
-        else:
-          theta /= -2.0
-
-        w3 = np.cos(theta)
-        sin_theta = np.sin(theta)
-        x3 = xlab[0] * sin_theta
-        y3 = xlab[1] * sin_theta
-        z3 = xlab[2] * sin_theta
-
-        w4 = w1*w3 - x1*x3 - y1*y3 - z1*z3
-        x4 = w1*x3 + x1*w3 + y1*z3 - z1*y3
-        y4 = w1*y3 - x1*z3 + y1*w3 + z1*x3
-        z4 = w1*z3 + x1*y3 - y1*x3 + z1*w3
-        self.voxel_quarts[voxel_id].extend([w4, x4, y4, z4])
-        self.voxel_O_coords[voxel_id].extend(owat)
+        self.calculate_orientations([water], coords)
+
+    def calculate_orientations(self, waters, coords):
+        """
+        Calculates the quaternions representing the orientations of a list of water molecules, in one call to the
+        vectorized kernel of the extension, and stores them with the oxygen coordinates in the voxels of the waters.
+
+        Parameters
+        ----------
+        waters : list
+            A list of tuples, each with the voxel index and the index of the oxygen atom of a water.
+        coords : numpy.ndarray
+            An array of x, y, z coordinates corresponding to atom positions in current frame.
+        """
+        if len(waters) == 0:
+            return
+        wat_ids = np.asarray([wat[1] for wat in waters])
+        wat_coords = coords[wat_ids[:, np.newaxis] + np.arange(3), :]
+        quats = calc.water_orientations(wat_coords)
+        for wat, owat, quat in zip(waters, wat_coords[:, 0, :], quats):
+            self.voxel_quarts[wat[0]].extend(quat.tolist())
+            self.voxel_O_coords[wat[0]].extend(owat.tolist())
 
     @function_timer
-    def calculate_entropy(self, num_frames=None):
+    def calculate_entropy(self, num_frames=None, exact_six_d=False):
         """
         Calculate solute-water translational and orientational entropy for each grid voxel using a nearest neighbors
         approach. This calculation can only be run after the voxels are populated with corresponding waters.
@@ -281,11 +217,15 @@ class GridWaterAnalysis(WaterAnalysis):
         ----------
         num_frames : int
             Number of frames processed during the analysis.
+        exact_six_d : bool
+            If True, the six dimensional nearest neighbour of each water is searched among all waters on the grid,
+            with q and -q taken as the same orientation, instead of in the neighbouring voxels only.
 
         """
         if num_frames is None:
             num_frames = self.num_frames
-        calc.getNNTrEntropy(num_frames, self.voxel_vol, self.rho_bulk, 300.0, self.grid_dims, self.voxeldata, self.voxel_O_coords, self.voxel_quarts)
+        calc.getNNTrEntropy(num_frames, self.voxel_vol, self.rho_bulk, 300.0, self.grid_dims, self.voxeldata,
+                            self.voxel_O_coords, self.voxel_quarts, int(exact_six_d))
 
     def _process_frame(self, trj, energy, hbonds, entropy):
         """
@@ -363,8 +303,8 @@ class GridWaterAnalysis(WaterAnalysis):
                         self.voxeldata[wat[0], 27] += don_sw
                         self.voxeldata[wat[0], 29] += acc_sw
 
-            if entropy:
-                self.calculate_euler_angles(wat, coords[0, :, :])
+        if entropy:
+            self.calculate_orientations(waters, coords[0, :, :])
 
     @function_timer
     def calculate_grid_quantities(self, energy=True, entropy=True, hbonds=True):
@@ -0,0 +1,311 @@
+/*
+ * File:   kdforest.h
+ *
+ * Dynamic counterpart of kdtree.h for clouds that grow while they are searched, waters accumulated frame by frame
+ * with the entropy looked at every so often.
+ *
+ * kdforest<Dim, Scalar> is a logarithmic forest of static trees. New points go to a small buffer that is scanned
+ * by brute force, and once the buffer holds bucket points it is merged with the trees of levels 0, 1, ... up to the
+ * first empty level, which receives one tree built from all of them. Level i so holds at most bucket*2^i points,
+ * there are never more than log2(n/bucket) trees and every point is rebuilt into a larger tree O(log n) times,
+ * which is what an insert costs amortised.
+ *
+ * Deletes are lazy: the point is hidden from the searches through the mask of the tree holding it (kdtree::mask)
+ * and only dropped when that tree is next merged, or rebuilt on its own once half of its points are gone.
+ *
+ * Points are known by the index insert returned, the same role the input order plays for kdtree, and the searches
+ * take and return those indices. dnearest and nnearest search every tree in turn, largest first, each one only
+ * looking for points nearer than the best found in the trees before it. A query still descends every tree, which
+ * makes it a few times slower than on a single tree of the same points (see the streaming part of kdtree_bench), so
+ * before a long run of queries with no inserts in between it pays to compact the forest into one tree.
+ */
+
+#ifndef KDFOREST_H
+#define KDFOREST_H
+#include "kdtree.h"
+
+template <int Dim, typename Scalar = double>
+struct kdforest {
+    typedef kdtree<Dim, Scalar> treetype;
+    typedef point<Dim, Scalar> pointtype;
+    static const int MAXLEVEL = 40;
+    struct level {
+        treetype *tree; //NULL for an empty level
+        std::vector<int> ids; //point index of every tree index
+        std::vector<unsigned char> mask; //the tree's mask, 0 for a deleted point
+        int ndead;
+        level() : tree(NULL), ndead(0) {}
+    };
+    int bucket, nthreads; //size of the insert buffer (and leaf size of the trees), threads used to build the trees
+    int nlive; //number of points inserted and not deleted
+    std::vector<Scalar> vals; //coordinates of every point ever inserted, point-major like the input of kdtree
+    std::vector<unsigned char> alive;
+    std::vector<int> where, local; //level of every point (-1 in the buffer) and its tree index, or buffer position
+    std::vector<int> buffer;
+    level levels[MAXLEVEL];
+    pointtype period;
+    bool periodic;
+    Scalar eps; //approximation of the tree searches, see kdtree::setepsilon (the buffer is always searched exactly)
+    kdforest(int bucket = KDBUCKET, int nthreads = 0);
+    ~kdforest() { for (int l = 0; l < MAXLEVEL; l++) delete levels[l].tree; }
+    void setperiod(int d, Scalar L);
+    void setepsilon(Scalar e) {
+        if (e < 0) throw("epsilon must be nonnegative");
+        eps = e;
+        for (int l = 0; l < MAXLEVEL; l++) if (levels[l].tree) levels[l].tree->setepsilon(e);
+    }
+    int insert(const Scalar *pt);
+    void insert(const std::vector<Scalar> &pts, int *ids = NULL);
+    bool remove(int id);
+    void compact();
+    int size() const { return nlive; }
+    void getpoint(int id, pointtype &pt) const { pt.set_point(&vals[id*Dim]); }
+    int ntrees() const;
+    void build(int l, const std::vector<int> &ids);
+    Scalar dist2(int id, const pointtype &pt) const {
+        Scalar d;
+        kdsimd_tail<Dim, Scalar>(&vals[id*Dim], 1, 0, 1, pt.x, periodic ? period.x : NULL, &d);
+        return d;
+    }
+    //same searches as kdtree, self being a point index
+    Scalar dnearest(const pointtype &pt, int self = -1) const;
+    Scalar dnearest(const pointtype &pt, int &nrst, int self) const;
+    void nnearest(int id, int *nn, Scalar *dn, int n) const;
+    void dnearest(const Scalar *qs, int nq, Scalar *dn, int *nn, const int *self = NULL, int nthreads = 0) const;
+    void nnearest(const int *ids, int nq, int *nn, Scalar *dn, int n, int nthreads = 0) const;
+private:
+    //the trees are owned through raw pointers, copies are not supported
+    kdforest(const kdforest &);
+    kdforest &operator=(const kdforest &);
+};
+
+template <int Dim, typename Scalar>
+kdforest<Dim, Scalar>::kdforest(int bucket, int nthreads)
+    : bucket(bucket), nthreads(nthreads), nlive(0), periodic(false), eps(0) {
+    if (bucket < 1) throw("bucket size must be at least 1");
+}
+
+template <int Dim, typename Scalar>
+void kdforest<Dim, Scalar>::setperiod(int d, Scalar L) {
+    if (L < 0) throw("period must be nonnegative");
+    period.x[d] = L;
+    periodic = false;
+    for (int i = 0; i < Dim; i++) if (period.x[i] != 0) periodic = true;
+    for (int l = 0; l < MAXLEVEL; l++) if (levels[l].tree) levels[l].tree->setperiod(d, L);
+}
+
+template <int Dim, typename Scalar>
+int kdforest<Dim, Scalar>::ntrees() const {
+    int n = 0;
+    for (int l = 0; l < MAXLEVEL; l++) if (levels[l].tree) n++;
+    return n;
+}
+
+template <int Dim, typename Scalar>
+void kdforest<Dim, Scalar>::build(int l, const std::vector<int> &ids) {
+    //level l becomes one tree of the live points among ids (empty when there are none)
+    level &lv = levels[l];
+    delete lv.tree;
+    lv.tree = NULL;
+    lv.ids.clear();
+    for (size_t i = 0; i < ids.size(); i++) if (alive[ids[i]]) lv.ids.push_back(ids[i]);
+    lv.mask.assign(lv.ids.size(), 1);
+    lv.ndead = 0;
+    if (lv.ids.empty()) return;
+    std::vector<Scalar> v(Dim*lv.ids.size());
+    for (size_t i = 0; i < lv.ids.size(); i++) {
+        where[lv.ids[i]] = l;
+        local[lv.ids[i]] = i;
+        for (int d = 0; d < Dim; d++) v[i*Dim + d] = vals[lv.ids[i]*Dim + d];
+    }
+    lv.tree = new treetype(v, bucket, nthreads);
+    for (int d = 0; d < Dim; d++) if (period.x[d] != 0) lv.tree->setperiod(d, period.x[d]);
+    lv.tree->setepsilon(eps);
+    lv.tree->mask = &lv.mask[0];
+}
+
+template <int Dim, typename Scalar>
+int kdforest<Dim, Scalar>::insert(const Scalar *pt) {
+    //adds the point pt (Dim values) and returns its index, the indices count up from 0 in insertion order
+    int id = alive.size();
+    vals.insert(vals.end(), pt, pt + Dim);
+    alive.push_back(1);
+    where.push_back(-1);
+    local.push_back(buffer.size());
+    buffer.push_back(id);
+    nlive++;
+    if ((int)buffer.size() < bucket) return id;
+
+    //carry the buffer up like a binary counter: levels 0..l-1 all hold a tree, level l is the first empty one
+    int l = 0;
+    while (l < MAXLEVEL && levels[l].tree) l++;
+    if (l == MAXLEVEL) throw("kdforest is full");
+    std::vector<int> ids(buffer);
+    for (int i = 0; i < l; i++) {
+        ids.insert(ids.end(), levels[i].ids.begin(), levels[i].ids.end());
+        delete levels[i].tree;
+        levels[i] = level();
+    }
+    buffer.clear();
+    build(l, ids);
+    return id;
+}
+
+template <int Dim, typename Scalar>
+void kdforest<Dim, Scalar>::insert(const std::vector<Scalar> &pts, int *ids) {
+    //point-major batch of pts.size()/Dim points, their indices go to ids when it is not NULL
+    int n = pts.size()/Dim;
+    for (int i = 0; i < n; i++) {
+        int id = insert(&pts[i*Dim]);
+        if (ids) ids[i] = id;
+    }
+}
+
+template <int Dim, typename Scalar>
+bool kdforest<Dim, Scalar>::remove(int id) {
+    //deletes point id, false if there is no such live point
+    if (id < 0 || id >= (int)alive.size() || !alive[id]) return false;
+    alive[id] = 0;
+    nlive--;
+    int l = where[id];
+    if (l < 0) {
+        //the buffer is unordered, the last point takes the place of the deleted one
+        int last = buffer.back();
+        buffer[local[id]] = last;
+        local[last] = local[id];
+        buffer.pop_back();
+        return true;
+    }
+    levels[l].mask[local[id]] = 0;
+    if (2*(++levels[l].ndead) > (int)levels[l].ids.size()) {
+        std::vector<int> ids(levels[l].ids);
+        build(l, ids);
+    }
+    return true;
+}
+
+template <int Dim, typename Scalar>
+void kdforest<Dim, Scalar>::compact() {
+    //rebuilds everything into the single tree of the level that fits it, for a long run of queries with no inserts
+    std::vector<int> ids(buffer);
+    for (int l = 0; l < MAXLEVEL; l++) {
+        ids.insert(ids.end(), levels[l].ids.begin(), levels[l].ids.end());
+        delete levels[l].tree;
+        levels[l] = level();
+    }
+    buffer.clear();
+    int n = 0;
+    for (size_t i = 0; i < ids.size(); i++) if (alive[ids[i]]) n++;
+    int l = 0;
+    while ((long long)bucket << l < n) l++;
+    build(l, ids);
+}
+
+template <int Dim, typename Scalar>
+Scalar kdforest<Dim, Scalar>::dnearest(const pointtype &pt, int self) const {
+    int nrst;
+    return dnearest(pt, nrst, self);
+}
+
+template <int Dim, typename Scalar>
+Scalar kdforest<Dim, Scalar>::dnearest(const pointtype &pt, int &nrst, int self) const {
+    Scalar dnrst = treetype::BIG;
+    nrst = -1;
+    for (size_t i = 0; i < buffer.size(); i++) {
+        Scalar d = dist2(buffer[i], pt);
+        if (d < dnrst && buffer[i] != self) {
+            dnrst = d;
+            nrst = buffer[i];
+        }
+    }
+    for (int l = MAXLEVEL-1; l >= 0; l--) {
+        const level &lv = levels[l];
+        if (!lv.tree) continue;
+        int jl = -1;
+        lv.tree->treenearest(pt, self >= 0 && where[self] == l ? local[self] : -1, dnrst, jl);
+        if (jl >= 0) nrst = lv.ids[jl];
+    }
+    return sqrt(dnrst);
+}
+
+template <int Dim, typename Scalar>
+void kdforest<Dim, Scalar>::nnearest(int id, int *nn, Scalar *dn, int n) const {
+    /*
+        n nearest neighbours of point id, sorted nearest first. Every tree fills a heap of its own that starts at the
+        worst distance of the neighbours found so far, what it finds is then merged into them.
+    */
+    if (n > nlive-1) throw("you're asking for too much buddy (nn > npts)");
+    if (n < 1) return;
+    pointtype pt;
+    getpoint(id, pt);
+    std::vector<Scalar> ld(n);
+    std::vector<int> ln(n);
+    for (int i = 0; i < n; i++) {
+        dn[i] = treetype::BIG;
+        nn[i] = -1;
+    }
+    for (size_t i = 0; i < buffer.size(); i++) {
+        Scalar d = dist2(buffer[i], pt);
+        if (d < dn[0] && buffer[i] != id) {
+            dn[0] = d;
+            nn[0] = buffer[i];
+            if (n > 1) treetype::sift_down(dn, nn, n);
+        }
+    }
+    for (int l = MAXLEVEL-1; l >= 0; l--) {
+        const level &lv = levels[l];
+        if (!lv.tree) continue;
+        std::fill(ld.begin(), ld.end(), dn[0]);
+        std::fill(ln.begin(), ln.end(), -1);
+        lv.tree->treeheap(pt, where[id] == l ? local[id] : -1, &ld[0], &ln[0], n);
+        for (int i = 0; i < n; i++) {
+            if (ln[i] >= 0 && ld[i] < dn[0]) {
+                dn[0] = ld[i];
+                nn[0] = lv.ids[ln[i]];
+                if (n > 1) treetype::sift_down(dn, nn, n);
+            }
+        }
+    }
+    std::vector<std::pair<Scalar, int> > row(n);
+    for (int i = 0; i < n; i++) row[i] = std::make_pair(dn[i], nn[i]);
+    std::sort(row.begin(), row.end());
+    for (int i = 0; i < n; i++) {
+        dn[i] = sqrt(row[i].first);
+        nn[i] = row[i].second;
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdforest<Dim, Scalar>::dnearest(const Scalar *qs, int nq, Scalar *dn, int *nn, const int *self, int nthreads) const {
+    //batch dnearest as in kdtree, self[i] is the point index query i excludes, or NULL for none
+    std::vector<int> order;
+    if (nq > 1024) {
+        order.resize(nq);
+        kdmorton<Dim, Scalar>(qs, nq, &order[0]);
+    }
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    #pragma omp parallel for schedule(dynamic, 256) num_threads(nthreads) if(nq > 512)
+#endif
+    for (int iq = 0; iq < nq; iq++) {
+        int i = order.empty() ? iq : order[iq];
+        pointtype pt;
+        pt.set_point(&qs[i*Dim]);
+        dn[i] = dnearest(pt, nn[i], self ? self[i] : -1);
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdforest<Dim, Scalar>::nnearest(const int *ids, int nq, int *nn, Scalar *dn, int n, int nthreads) const {
+    //batch nnearest, the neighbours of ids[i] go to nn[i*n..i*n+n-1] and dn[i*n..i*n+n-1]
+    if (n > nlive-1) throw("you're asking for too much buddy (nn > npts)");
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    #pragma omp parallel for schedule(dynamic, 256) num_threads(nthreads) if(nq > 512)
+#endif
+    for (int i = 0; i < nq; i++) {
+        nnearest(ids[i], &nn[i*n], &dn[i*n], n);
+    }
+}
+
+#endif /* KDFOREST_H */
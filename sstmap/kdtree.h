@@ -0,0 +1,1608 @@
+/*
+ * File:   kdtree.h
+ *
+ * Header-only k-d tree used by the entropy and probable configuration codes.
+ *
+ * The tree is a template over the dimension and the coordinate type, kdtree<Dim, Scalar>, so that the
+ * same code drives the 3D translational tree, the 3D Euler angle orientational tree and the 7D
+ * position + quaternion tree. Every per-coordinate loop (point distances, point to box distances) is
+ * expanded at compile time through kdunroll, there is no runtime dimension anywhere in the tree. A float tree
+ * takes half the memory and its leaf kernels handle twice the points per instruction, the entropy sums are still
+ * taken in double. The entropy codes pick the precision per call, KDSINGLE sets their default.
+ *
+ * Storage is flat: points carry their coordinates inline and the tree keeps every coordinate in one
+ * dimension-major buffer. Once the tree is built that buffer is put in tree order, coord[d*npts + j] is
+ * dimension d of point ptindx[j], so the points of a box are contiguous. Boxes stop being split once they hold
+ * no more than bucket points, and the searches scan those leaves a block at a time with the vector kernels of
+ * kdtree_simd.h instead of walking further down the tree.
+ *
+ * Construction is parallel when compiled with OpenMP: once a box is split its two daughters are independent,
+ * so every daughter holding at least ntask points is handed to the OpenMP task scheduler while the rest of the
+ * subtree is built in place. Box numbers are fixed up front, the tree is identical for any number of threads.
+ *
+ * Waters come in frame order, which jumps all over the site, so the batch searches do not take their queries in
+ * the order given: they sort them along a Morton curve (kdmorton, which callers can also use to reorder points
+ * themselves and keep the permutation) and write every result back to the slot of its query. Consecutive queries
+ * then walk the same boxes and leaves.
+ *
+ * The searches compare squared distances only and take a single sqrt per returned neighbour. A point never
+ * finds itself because it is skipped by index, so two waters sitting on exactly the same spot are neighbours at
+ * a distance of 0.
+ *
+ * Any dimension can be made periodic with setperiod, distances along it are then taken to the minimum image,
+ * both between points and from a point to a box, so a single search finds the nearest neighbour on the torus.
+ * The Euler angle tree uses this for its two wrapped angles.
+ *
+ * The nearest neighbour searches can be made approximate with setepsilon(eps): a box is then skipped as soon as it
+ * is further than the best distance so far divided by 1 + eps, so what is returned is at most 1 + eps times the
+ * true distance (the k-th returned against the true k-th for the k nearest). The radius searches stay exact.
+ *
+ * all_nearest answers the k nearest neighbours of every point of the tree at once by walking pairs of boxes,
+ * a query box and a reference box, and dropping the pair as soon as the boxes are further apart than the worst
+ * k-th neighbour found so far for any point of the query box. It relies on the tight bounds blo/bhi of the points
+ * of every box, set at the end of the build.
+ *
+ * The arrays of a built tree (boxes, point permutation, coordinates, tight bounds) sit in one buffer laid out
+ * exactly like the body of a tree file. save writes that buffer after a header holding a version, the sizes the
+ * layout depends on and a checksum, and the file constructor maps a saved tree read-only and points the arrays
+ * straight into the mapping, so a tree is queried again without parsing or rebuilding anything.
+ */
+
+#ifndef KDTREE_H
+#define KDTREE_H
+#include <algorithm>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "kdtree_simd.h"
+
+//default number of points in a leaf, see the bucket size sweep of kdtree_bench
+#define KDBUCKET 64
+//precision of the trees of the entropy codes when the caller does not choose, 1 for float and 0 for double
+#ifndef KDSINGLE
+#define KDSINGLE 0
+#endif
+//version of the tree file layout, to be raised whenever boxnode or the order of the arrays changes
+#define KDFILE_VERSION 1
+
+/*
+    64 bit FNV-1a over 8 byte words (the trailing bytes one at a time), used for the checksum of tree files and by
+    callers that want to tie a saved tree to the file it was built from.
+*/
+inline unsigned long long kdchecksum(const char *buf, size_t n, unsigned long long h = 14695981039346656037ULL) {
+    size_t nw = n/8;
+    for (size_t i = 0; i < nw; i++) {
+        unsigned long long w;
+        memcpy(&w, buf + 8*i, 8);
+        h ^= w;
+        h *= 1099511628211ULL;
+    }
+    for (size_t i = 8*nw; i < n; i++) {
+        h ^= (unsigned char)buf[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+struct kdfileheader {
+    char magic[8]; //"KDTREE" padded with zeros
+    int version, endian; //KDFILE_VERSION and 0x01020304 as written by the machine that saved the tree
+    int dim, scalarsize, boxsize; //Dim, sizeof(Scalar) and sizeof(boxnode), the layout of the body depends on them
+    int npts, numbox, bucket;
+    unsigned long long tag; //left to the caller
+    unsigned long long body, checksum; //size of everything after the header and its kdchecksum
+    char reserved[64]; //zeros, pads the header to 128 bytes so that the arrays behind it stay aligned
+};
+
+/*
+    Compile-time expansion of the coordinate loops. kdunroll<Dim, Scalar>::dist2(p, ps, q) is the squared
+    distance between p (stride ps between coordinates) and q (contiguous), written out term by term.
+*/
+template <int Dim, typename Scalar, int I = 0>
+struct kdunroll {
+    static inline Scalar dist2(const Scalar* p, int ps, const Scalar* q) {
+        Scalar d = p[I*ps] - q[I];
+        return d*d + kdunroll<Dim, Scalar, I+1>::dist2(p, ps, q);
+    }
+    static inline Scalar boxdist2(const Scalar* lo, const Scalar* hi, const Scalar* q) {
+        Scalar d = 0;
+        if (q[I] < lo[I]) d = q[I] - lo[I];
+        else if (q[I] > hi[I]) d = q[I] - hi[I];
+        return d*d + kdunroll<Dim, Scalar, I+1>::boxdist2(lo, hi, q);
+    }
+};
+
+template <int Dim, typename Scalar>
+struct kdunroll<Dim, Scalar, Dim> {
+    static inline Scalar dist2(const Scalar*, int, const Scalar*) { return 0; }
+    static inline Scalar boxdist2(const Scalar*, const Scalar*, const Scalar*) { return 0; }
+};
+
+template <int Dim, typename Scalar = double>
+struct point {
+    Scalar x[Dim];
+    point() {
+        for (int i = 0; i < Dim; i++) x[i] = 0;
+    }
+    void set_point(const Scalar* vals) {
+        for (int i = 0; i < Dim; i++) x[i] = vals[i];
+    }
+    void print_point() const {
+        for (int i = 0; i < Dim; i++) std::cout << x[i] << "\t";
+        std::cout << std::endl;
+    }
+};
+
+template <int Dim, typename Scalar>
+inline Scalar dist2(const point<Dim, Scalar> &p, const point<Dim, Scalar> &q) {
+    return kdunroll<Dim, Scalar>::dist2(p.x, 1, q.x);
+}
+
+template <int Dim, typename Scalar>
+inline Scalar dist(const point<Dim, Scalar> &p, const point<Dim, Scalar> &q) {
+    return sqrt(dist2(p, q));
+}
+
+template <int Dim, typename Scalar = double>
+struct boxnode {
+    int mom, dau1, dau2, ptlo, pthi; //these are all integers which will work to point towards the specified thing in their data structure
+    point<Dim, Scalar> lo, hi; //diagonally opposite corners of the box (min, max)
+    boxnode() : mom(0), dau1(0), dau2(0), ptlo(0), pthi(0) {}
+    void set_boxnode(const point<Dim, Scalar> &mylo, const point<Dim, Scalar> &myhi, int mymom, int myd1, int myd2, int myptlo, int mypthi) {
+        lo = mylo; hi = myhi;
+        mom = mymom; dau1 = myd1; dau2 = myd2;
+        ptlo = myptlo; pthi = mypthi;
+    }
+};
+
+template <int Dim, typename Scalar>
+inline Scalar dist2(const boxnode<Dim, Scalar> &b, const point<Dim, Scalar> &p) {
+    return kdunroll<Dim, Scalar>::boxdist2(b.lo.x, b.hi.x, p.x); //This will return 0 if the point is in the box
+}
+
+template <int Dim, typename Scalar>
+inline Scalar dist(const boxnode<Dim, Scalar> &b, const point<Dim, Scalar> &p) {
+    return sqrt(dist2(b, p));
+}
+
+/*
+    Morton (Z-order) permutation of n point-major points: every coordinate is scaled to 63/Dim bits over the extent
+    of the points and the bits of all coordinates are interleaved into one key. order[i] receives the input index of
+    the i-th point along the curve, so points next to each other in order tend to be next to each other in space.
+*/
+template <int Dim, typename Scalar>
+void kdmorton(const Scalar *vals, int n, int *order) {
+    const int bits = 63/Dim;
+    Scalar lo[Dim], hi[Dim];
+    double scale[Dim];
+    for (int d = 0; d < Dim; d++) lo[d] = hi[d] = n ? vals[d] : 0;
+    for (int i = 0; i < n; i++) {
+        for (int d = 0; d < Dim; d++) {
+            lo[d] = std::min(lo[d], vals[i*Dim + d]);
+            hi[d] = std::max(hi[d], vals[i*Dim + d]);
+        }
+    }
+    for (int d = 0; d < Dim; d++) scale[d] = hi[d] > lo[d] ? ((1ULL << bits) - 1)/double(hi[d] - lo[d]) : 0;
+    std::vector<std::pair<unsigned long long, int> > key(n);
+    for (int i = 0; i < n; i++) {
+        unsigned long long q[Dim], k = 0;
+        for (int d = 0; d < Dim; d++) q[d] = (unsigned long long)((vals[i*Dim + d] - lo[d])*scale[d]);
+        for (int b = bits-1; b >= 0; b--) {
+            for (int d = 0; d < Dim; d++) k = (k << 1) | ((q[d] >> b) & 1);
+        }
+        key[i] = std::make_pair(k, i);
+    }
+    std::sort(key.begin(), key.end());
+    for (int i = 0; i < n; i++) order[i] = key[i].second;
+}
+
+/*
+    Partial sort of indx[0..n-1] so that arr[indx[k]] is the k-th smallest value, everything below it in indx
+    is not larger and everything above it is not smaller.
+*/
+template <typename Scalar>
+int selecti(const int k, int *indx, int n, const Scalar *arr) {
+    int i, ia, ir, j, l, mid;
+    Scalar a;
+
+    l = 0;
+    ir = n-1;
+    for (;;) {
+        if (ir <= l+1) {
+            if (ir == l+1 && arr[indx[ir]] < arr[indx[l]]) {
+                std::swap(indx[l], indx[ir]);
+            }
+            return indx[k]; //final end point
+        }
+        else {
+            mid = (l+ir) >> 1;
+            std::swap(indx[mid], indx[l+1]);
+            if (arr[indx[l]] > arr[indx[ir]]) std::swap(indx[l], indx[ir]);
+            if (arr[indx[l+1]] > arr[indx[ir]]) std::swap(indx[l+1], indx[ir]);
+            if (arr[indx[l]] > arr[indx[l+1]]) std::swap(indx[l], indx[l+1]);
+            i = l+1;
+            j = ir;
+            ia = indx[l+1];
+            a = arr[ia];
+            for (;;) {
+                do i++; while (arr[indx[i]] < a);
+                do j--; while (arr[indx[j]] > a);
+                if (j < i) break; //inner endpoint
+                std::swap(indx[i], indx[j]);
+            }
+            indx[l+1] = indx[j];
+            indx[j] = ia;
+            if (j >= k) ir=j-1;
+            if (j <= k) l = i;
+        }
+    }
+}
+
+template <int Dim, typename Scalar = double>
+struct kdtree {
+    typedef point<Dim, Scalar> pointtype;
+    typedef boxnode<Dim, Scalar> boxtype;
+    static const Scalar BIG; //this value is a placeholder for starting box size (will be absurd)
+    static const int BLOCK = 64; //number of leaf points handed to the distance kernel at once
+    int numbox, npts, bucket; //integer counts of boxes and points, and the most points a leaf holds
+    //the arrays point into store for a tree built here, or into the mapped file for a loaded one
+    boxtype *boxes;
+    int *ptindx, *rptindx; //point index and reverse point index
+    Scalar *coord; //coordinates in tree order, coord[d*npts + j] is dimension d of point ptindx[j]
+    pointtype *blo, *bhi; //smallest and largest coordinates of the points inside every box
+    pointtype period; //period of every dimension, 0 for an open one
+    pointtype cmin, cmax; //smallest and largest coordinate in every dimension
+    bool periodic; //true once any dimension has a period
+    unsigned long long tag; //saved with the tree and restored on loading, free for the caller to use
+    const unsigned char *mask; //NULL, or mask[i] == 0 hides point i from every search (the lazy deletes of kdforest)
+    Scalar shrink; //1/(1 + eps)^2, the nearest neighbour searches prune a box when shrink*(squared bound) <= its distance
+    bool zorder; //the batch searches visit their queries along a space filling curve rather than in input order
+    std::vector<char> store;
+    void *map;
+    size_t maplen;
+    kdtree(const std::vector<Scalar> &vals, int bucket = KDBUCKET, int nthreads = 0, int ntask = 16384);
+    kdtree(const std::string &file, bool verify = true);
+    ~kdtree() { if (map) munmap(map, maplen); }
+    void save(const std::string &file) const;
+    static size_t layout(int np, int nb, size_t *off);
+    void setarrays(char *body);
+    static int countboxes(int np, int bucket, std::map<int, int> &nsub);
+    void splitbox(int tmom, int tdim, int jbox, int ntask, const std::map<int, int> *nsub);
+    //utility functions for use after tree is constructed
+    void setperiod(int d, Scalar L) {
+        if (L < 0) throw("period must be nonnegative");
+        period.x[d] = L;
+        periodic = false;
+        for (int i = 0; i < Dim; i++) if (period.x[i] != 0) periodic = true;
+    }
+    //approximate nearest neighbours, every distance returned is within a factor 1 + eps of the exact one (0: exact)
+    void setepsilon(Scalar eps) {
+        if (eps < 0) throw("epsilon must be nonnegative");
+        shrink = 1/((1 + eps)*(1 + eps));
+    }
+    Scalar coordinate(int jpt, int d) const { return coord[d*npts + rptindx[jpt]]; }
+    void getpoint(int jpt, pointtype &pt) const {
+        for (int d = 0; d < Dim; d++) pt.x[d] = coord[d*npts + rptindx[jpt]];
+    }
+    Scalar disti(int jpt, int kpt) const;
+    Scalar distpt(int jpt, const pointtype &pt) const;
+    Scalar distpt2(int jpt, const pointtype &pt) const {
+        Scalar d;
+        kdsimd_tail<Dim, Scalar>(&coord[rptindx[jpt]], npts, 0, 1, pt.x, periodic ? period.x : NULL, &d);
+        return d;
+    }
+    Scalar boxdist2(int k, const pointtype &pt) const;
+    //leaf scans over the tree positions jlo..jhi, skipping the point self
+    void scannearest(int jlo, int jhi, const pointtype &pt, int self, Scalar &dnrst, int &nrst) const;
+    void scanheap(int jlo, int jhi, const pointtype &pt, int self, Scalar *dn, int *nn, int n) const;
+    void scangroups(int jlo, int jhi, const pointtype &pt, int self, const int *group, Scalar *dg) const;
+    //whole tree versions, they only improve on what dnrst/nrst or the heap dn/nn already hold (squared distances)
+    void treenearest(const pointtype &pt, int self, Scalar &dnrst, int &nrst) const;
+    void treeheap(const pointtype &pt, int self, Scalar *dn, int *nn, int n) const;
+    void treegroups(const pointtype &pt, int self, const int *group, int own, Scalar *dg) const;
+    int locate(const pointtype &pt) const;
+    int locate(int jpt) const;
+    //applications to use tree
+    int findpoint(const pointtype &pt) const;
+    void findpoint(const Scalar *qs, int nq, int *idx, int nthreads = 0) const;
+    Scalar dnearest(const pointtype &pt, int self = -1) const;
+    Scalar dnearest(const pointtype &pt, int &nrst, int self) const;
+    void nnearest(int jpt, int *nn, Scalar *dn, int n) const;
+    //batch versions of the two searches above, the queries are spread over nthreads threads (0 for the OpenMP default)
+    void dnearest(const Scalar *qs, int nq, Scalar *dn, int *nn, const int *self = NULL, int nthreads = 0) const;
+    void nnearest(const int *jpts, int nq, int *nn, Scalar *dn, int n, int nthreads = 0) const;
+    void queryorder(const Scalar *qs, int nq, std::vector<int> &order) const;
+    //k nearest neighbours of nq query points laid out as for the batch dnearest, sorted nearest first into
+    //nn[i*k..i*k+k-1] and dn[i*k..i*k+k-1]
+    void knearest(const Scalar *qs, int nq, int k, int *nn, Scalar *dn, const int *self = NULL, int nthreads = 0) const;
+    //nearest neighbours of nq queries within groups of the points, for windows of a trajectory (see groupnearest)
+    void groupnearest(const Scalar *qs, int nq, const int *group, int ngroup, const int *own, Scalar *dblock,
+                      Scalar *dprefix, const int *self = NULL, int nthreads = 0) const;
+    //k nearest neighbours of every point, point i gets nn[i*k..i*k+k-1] and dn[i*k..i*k+k-1] sorted nearest first
+    void all_nearest(int k, int *nn, Scalar *dn, int nthreads = 0, int ntask = 4096) const;
+    Scalar nodedist2(int kq, int kr) const;
+    Scalar pointdist2(int kr, const pointtype &pt) const;
+    Scalar diameter2(int kq) const;
+    static Scalar widen(Scalar a2, Scalar b2) { Scalar r = sqrt(a2) + sqrt(b2); return r*r; } //(|a| + |b|)^2
+    void dualnearest(int kq, int kr, int k, Scalar *hd, int *hn, Scalar *bound, Scalar *mink, int ntask) const;
+    static void sift_down(Scalar *heap, int *ndx, int nn);
+    int locatenear(const pointtype &pt, Scalar r, int *v, int nmax) const;
+    //radius searches with no limit on the number of points: all of them into v, or only their number
+    int locatenear(const pointtype &pt, Scalar r, std::vector<int> &v) const;
+    int countnear(const pointtype &pt, Scalar r) const;
+    void countnear(const Scalar *qs, int nq, Scalar r, int *counts, int nthreads = 0) const;
+    int radius(const pointtype &pt, Scalar r, std::vector<int> *v) const;
+    Scalar farthest2(int k, const pointtype &pt) const;
+    //entropy estimates, these two assume the 3D translational and 3D Euler angle trees respectively, the latter with
+    //dimensions 1 and 2 set to a period of 2pi. Given dist and logterm they also receive, for each water, the
+    //distance to its nearest neighbour and the log term the entropy averages, NaN for a water left out. With no
+    //water to average over (an empty cluster, or only duplicates at distance 0) the estimate itself is NaN
+    double run_tree_trans(const std::vector<Scalar> &cls, double *dist = NULL, double *logterm = NULL) const;
+    double run_tree_orient(double *dist = NULL, double *logterm = NULL) const;
+    //the same from the k-th nearest neighbour for every k = 1..kmax at once, s[k-1] receives the k-th estimate and
+    //water i the distances and log terms of its k = 1..kmax neighbours at dist[i*kmax..i*kmax+kmax-1]
+    void run_tree_trans(const std::vector<Scalar> &cls, int kmax, double *s, double *dist = NULL,
+                        double *logterm = NULL) const;
+    void run_tree_orient(int kmax, double *s, double *dist = NULL, double *logterm = NULL) const;
+    //the nearest neighbour estimates within each of ngroup blocks of frames and within the growing prefixes of
+    //them, sblock[j] and sprefix[j] for block j and for blocks 0..j, from one groupnearest pass
+    void run_tree_trans(const std::vector<Scalar> &cls, const int *clsgroup, const int *group, int ngroup,
+                        const int *frames, double *sblock, double *sprefix) const;
+    void run_tree_orient(const int *group, int ngroup, double *sblock, double *sprefix) const;
+private:
+    //the arrays may point into this object's own store, copies are not supported
+    kdtree(const kdtree &);
+    kdtree &operator=(const kdtree &);
+};
+
+template <int Dim, typename Scalar>
+const Scalar kdtree<Dim, Scalar>::BIG(sizeof(Scalar) < sizeof(double) ? 1.0e30 : 1.0e99);
+
+template <int Dim, typename Scalar>
+kdtree<Dim, Scalar>::kdtree(const std::vector<Scalar> &vals, int bucket, int nthreads, int ntask)
+    : bucket(bucket), periodic(false), tag(0), mask(NULL), shrink(1), zorder(true), map(NULL), maplen(0) {
+    /*
+        This function assumes the values fed in through vals are only the pertinent ones, IE if this is 3d its the
+        positions or orientations and nothing else. vals is point-major (x0 y0 z0 x1 y1 z1 ...), the tree keeps it
+        dimension-major in coord so that the median selection walks contiguous memory.
+        bucket is the largest number of points left in a leaf, nthreads the number of threads used to build the tree
+        (0 for the OpenMP default) and ntask the smallest subtree that is worth a task of its own.
+    */
+    if (bucket < 1) throw("bucket size must be at least 1");
+    npts = vals.size()/Dim;
+    std::map<int, int> nsub;
+    numbox = 1 + (npts > bucket ? countboxes(npts, bucket, nsub) : 0);
+    size_t off[6];
+    store.resize(layout(npts, numbox, off));
+    setarrays(store.data());
+
+    //the median selection runs on the coordinates in input order, they are put in tree order once the tree is built
+    std::vector<Scalar> vcoord(Dim*npts);
+    coord = vcoord.data();
+    for (int k = 0; k < npts; k++) {
+        for (int j = 0; j < Dim; j++) {
+            coord[j*npts + k] = vals[k*Dim + j];
+        }
+    }
+    for (int j = 0; j < Dim && npts; j++) {
+        cmin.x[j] = *std::min_element(&coord[j*npts], &coord[j*npts] + npts);
+        cmax.x[j] = *std::max_element(&coord[j*npts], &coord[j*npts] + npts);
+    }
+
+    for (int k = 0; k < npts; k++) ptindx[k] = k;
+    for (int k = 0; k < numbox; k++) boxes[k] = boxtype();
+
+    pointtype lo, hi;
+    for (int i = 0; i < Dim; i++) {
+        hi.x[i] = BIG;
+        lo.x[i] = -BIG;
+    }
+    boxes[0].set_boxnode(lo, hi, 0, 0, 0, 0, npts-1);
+    if (numbox == 1) ntask = npts; //the root is a leaf, nothing to build
+
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    if (nthreads > 1 && npts >= 2*ntask && !omp_in_parallel()) {
+        #pragma omp parallel num_threads(nthreads)
+        {
+            #pragma omp single
+            splitbox(0, 0, 1, ntask, &nsub);
+        }
+    }
+    else if (numbox > 1) {
+        //either serial or already inside a parallel region, in which case the tasks go to the enclosing team
+        splitbox(0, 0, 1, ntask, &nsub);
+    }
+#else
+    if (numbox > 1) splitbox(0, 0, 1, ntask, &nsub);
+#endif
+    for (int j = 0; j < npts; j++) rptindx[ptindx[j]] = j;
+
+    coord = (Scalar*)(store.data() + off[3]);
+    for (int d = 0; d < Dim; d++) {
+        for (int j = 0; j < npts; j++) coord[d*npts + j] = vcoord[d*npts + ptindx[j]];
+    }
+
+    //daughters are always numbered after their mother, so one backward sweep fills the tight bounds bottom up
+    for (int k = numbox-1; k >= 0; k--) {
+        if (boxes[k].dau1) {
+            for (int d = 0; d < Dim; d++) {
+                blo[k].x[d] = std::min(blo[boxes[k].dau1].x[d], blo[boxes[k].dau2].x[d]);
+                bhi[k].x[d] = std::max(bhi[boxes[k].dau1].x[d], bhi[boxes[k].dau2].x[d]);
+            }
+        }
+        else {
+            for (int d = 0; d < Dim; d++) {
+                blo[k].x[d] = BIG;
+                bhi[k].x[d] = -BIG;
+                for (int j = boxes[k].ptlo; j <= boxes[k].pthi; j++) {
+                    blo[k].x[d] = std::min(blo[k].x[d], coord[d*npts + j]);
+                    bhi[k].x[d] = std::max(bhi[k].x[d], coord[d*npts + j]);
+                }
+            }
+        }
+    }
+}
+
+template <int Dim, typename Scalar>
+size_t kdtree<Dim, Scalar>::layout(int np, int nb, size_t *off) {
+    /*
+        Offsets of boxes, ptindx, rptindx, coord, blo and bhi in the body of a tree of np points and nb boxes, each
+        array starting on a 64 byte boundary. Returns the size of the body.
+    */
+    size_t sizes[6] = {nb*sizeof(boxtype), np*sizeof(int), np*sizeof(int), Dim*np*sizeof(Scalar),
+                       nb*sizeof(pointtype), nb*sizeof(pointtype)};
+    size_t n = 0;
+    for (int i = 0; i < 6; i++) {
+        off[i] = n;
+        n += (sizes[i] + 63)/64*64;
+    }
+    return n;
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::setarrays(char *body) {
+    size_t off[6];
+    layout(npts, numbox, off);
+    boxes = (boxtype*)(body + off[0]);
+    ptindx = (int*)(body + off[1]);
+    rptindx = (int*)(body + off[2]);
+    coord = (Scalar*)(body + off[3]);
+    blo = (pointtype*)(body + off[4]);
+    bhi = (pointtype*)(body + off[5]);
+}
+
+/*
+    A tree file is a kdfileheader, the period, cmin and cmax points padded to 64 bytes, and the body as laid out by
+    layout. The checksum in the header covers everything after it.
+*/
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::save(const std::string &file) const {
+    size_t off[6];
+    size_t nbody = layout(npts, numbox, off);
+    char extra[(3*sizeof(pointtype) + 63)/64*64];
+    memset(extra, 0, sizeof(extra));
+    memcpy(extra, &period, sizeof(pointtype));
+    memcpy(extra + sizeof(pointtype), &cmin, sizeof(pointtype));
+    memcpy(extra + 2*sizeof(pointtype), &cmax, sizeof(pointtype));
+
+    kdfileheader h;
+    memset(&h, 0, sizeof(h));
+    strncpy(h.magic, "KDTREE", sizeof(h.magic));
+    h.version = KDFILE_VERSION;
+    h.endian = 0x01020304;
+    h.dim = Dim;
+    h.scalarsize = sizeof(Scalar);
+    h.boxsize = sizeof(boxtype);
+    h.npts = npts;
+    h.numbox = numbox;
+    h.bucket = bucket;
+    h.tag = tag;
+    h.body = sizeof(extra) + nbody;
+    h.checksum = kdchecksum((const char*)boxes, nbody, kdchecksum(extra, sizeof(extra)));
+
+    //written next to the target and renamed over it, a process that has the old file mapped keeps a valid tree
+    std::string tmp = file + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) throw("cannot open kdtree file for writing");
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(extra, sizeof(extra), 1, f) == 1 &&
+              fwrite(boxes, nbody, 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+        remove(tmp.c_str());
+        throw("cannot write kdtree file");
+    }
+}
+
+template <int Dim, typename Scalar>
+kdtree<Dim, Scalar>::kdtree(const std::string &file, bool verify) : tag(0), mask(NULL), shrink(1), zorder(true), map(NULL), maplen(0) {
+    /*
+        Map a tree written by save. The file is mapped read-only and shared by every process that maps it, nothing
+        is copied but the header. verify recomputes the checksum, which reads the whole file once.
+    */
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) throw("cannot open kdtree file");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(kdfileheader)) {
+        close(fd);
+        throw("not a kdtree file");
+    }
+    maplen = st.st_size;
+    map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        throw("cannot map kdtree file");
+    }
+
+    const char *err = NULL;
+    kdfileheader h;
+    memcpy(&h, map, sizeof(h));
+    size_t nextra = (3*sizeof(pointtype) + 63)/64*64;
+    size_t off[6];
+    if (strncmp(h.magic, "KDTREE", sizeof(h.magic)) != 0) err = "not a kdtree file";
+    else if (h.version != KDFILE_VERSION) err = "unsupported kdtree file version";
+    else if (h.endian != 0x01020304) err = "kdtree file was written on a machine of the other endianness";
+    else if (h.dim != Dim || h.scalarsize != (int)sizeof(Scalar) || h.boxsize != (int)sizeof(boxtype)) {
+        err = "kdtree file holds a tree of another dimension or coordinate type";
+    }
+    else if (h.body != nextra + layout(h.npts, h.numbox, off) || maplen != sizeof(h) + h.body) {
+        err = "kdtree file is truncated or the wrong size";
+    }
+    else if (verify && kdchecksum((const char*)map + sizeof(h), h.body) != h.checksum) {
+        err = "kdtree file checksum mismatch";
+    }
+    if (err) {
+        munmap(map, maplen);
+        map = NULL;
+        throw(err);
+    }
+
+    npts = h.npts;
+    numbox = h.numbox;
+    bucket = h.bucket;
+    tag = h.tag;
+    const char *extra = (const char*)map + sizeof(h);
+    memcpy(&period, extra, sizeof(pointtype));
+    memcpy(&cmin, extra + sizeof(pointtype), sizeof(pointtype));
+    memcpy(&cmax, extra + 2*sizeof(pointtype), sizeof(pointtype));
+    periodic = false;
+    for (int i = 0; i < Dim; i++) if (period.x[i] != 0) periodic = true;
+    setarrays((char*)map + sizeof(h) + nextra);
+}
+
+template <int Dim, typename Scalar>
+int kdtree<Dim, Scalar>::countboxes(int np, int bucket, std::map<int, int> &nsub) {
+    /*
+        Number of boxes created below a box of np points when it is split. Daughters are split again as long as
+        they hold more than bucket points. The sizes found on the way are remembered in nsub.
+    */
+    std::map<int, int>::iterator it = nsub.find(np);
+    if (it != nsub.end()) return it->second;
+    int kk = (np-1)/2;
+    int nleft = kk + 1, nright = np - kk - 1;
+    int n = 2;
+    if (nleft > bucket) n += countboxes(nleft, bucket, nsub);
+    if (nright > bucket) n += countboxes(nright, bucket, nsub);
+    nsub[np] = n;
+    return n;
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::splitbox(int tmom, int tdim, int jbox, int ntask, const std::map<int, int> *nsub) {
+    /*
+        Split box tmom at the median along tdim, its daughters become boxes jbox and jbox+1. Below them the boxes
+        are numbered the way a depth first build that always descends into dau2 first numbers them: the subtree of
+        dau2 takes the next countboxes(dau2) numbers and the subtree of dau1 the ones after.
+    */
+    int ptlo = boxes[tmom].ptlo;
+    int pthi = boxes[tmom].pthi;
+    int *hp = &ptindx[ptlo];
+    int np = pthi - ptlo + 1;
+    int kk = (np-1)/2;
+    selecti(kk, hp, np, &coord[tdim*npts]);
+    pointtype lo = boxes[tmom].lo, hi = boxes[tmom].hi;
+    hi.x[tdim] = lo.x[tdim] = coord[tdim*npts + hp[kk]];
+    boxes[jbox].set_boxnode(boxes[tmom].lo, hi, tmom, 0, 0, ptlo, ptlo+kk);
+    boxes[jbox+1].set_boxnode(lo, boxes[tmom].hi, tmom, 0, 0, ptlo+kk+1, pthi);
+    boxes[tmom].dau1 = jbox;
+    boxes[tmom].dau2 = jbox+1;
+
+    int ndim = (tdim+1)%Dim;
+    int nright = np - kk - 1;
+    int jright = jbox + 2;
+    int jleft = jright + (nright > bucket ? nsub->find(nright)->second : 0);
+    if (nright > bucket) {
+#ifdef _OPENMP
+        #pragma omp task if(nright >= ntask) firstprivate(jbox, ndim, jright, ntask, nsub)
+#endif
+        splitbox(jbox+1, ndim, jright, ntask, nsub);
+    }
+    if (kk + 1 > bucket) splitbox(jbox, ndim, jleft, ntask, nsub);
+#ifdef _OPENMP
+    #pragma omp taskwait
+#endif
+}
+
+template <int Dim, typename Scalar>
+Scalar kdtree<Dim, Scalar>::disti(int jpt, int kpt) const {
+    if (jpt == kpt) return BIG; //to avoid the closest neighbor is itself
+    pointtype p;
+    getpoint(kpt, p);
+    return distpt(jpt, p);
+}
+
+template <int Dim, typename Scalar>
+Scalar kdtree<Dim, Scalar>::distpt(int jpt, const pointtype &pt) const {
+    return sqrt(distpt2(jpt, pt));
+}
+
+template <int Dim, typename Scalar>
+Scalar kdtree<Dim, Scalar>::boxdist2(int k, const pointtype &pt) const {
+    /*
+        squared distance from pt to box k, 0 inside it. The outer boxes reach out to BIG, along a periodic
+        dimension that would cover every image, so the bounds are first cut down to the extent of the points.
+    */
+    if (!periodic) return dist2(boxes[k], pt);
+    Scalar d = 0;
+    for (int i = 0; i < Dim; i++) {
+        Scalar lo = std::max(boxes[k].lo.x[i], cmin.x[i]), hi = std::min(boxes[k].hi.x[i], cmax.x[i]);
+        Scalar q = pt.x[i], L = period.x[i], t = 0;
+        if (q >= lo && q <= hi) t = 0;
+        else if (L == 0) t = q < lo ? lo - q : q - hi;
+        else if (hi - lo < L) {
+            //a is how far the image of q just above lo lies beyond lo, it is inside the box when a <= hi - lo
+            Scalar a = q - lo;
+            a -= L*floor(a/L);
+            if (a > hi - lo) t = std::min(a - (hi - lo), L - a);
+        }
+        d += t*t;
+    }
+    return d;
+}
+
+template <int Dim, typename Scalar>
+int kdtree<Dim, Scalar>::locate(const pointtype &pt) const {
+    int nb, d1, jdim;
+    nb = jdim = 0;
+    while (boxes[nb].dau1) { //basically keep going until bottom from root
+        d1 = boxes[nb].dau1;
+        if (pt.x[jdim] <= boxes[d1].hi.x[jdim]) nb = d1;
+        else nb = boxes[nb].dau2;
+        jdim = (jdim+1)%Dim;
+    }
+    return nb;
+}
+
+template <int Dim, typename Scalar>
+int kdtree<Dim, Scalar>::locate(int jpt) const {
+    int nb, d1, jh;
+    jh = rptindx[jpt];
+    nb = 0;
+    while (boxes[nb].dau1) {
+        d1 = boxes[nb].dau1;
+        if (jh <= boxes[d1].pthi) nb = d1;
+        else nb = boxes[nb].dau2;
+    }
+    return nb;
+}
+
+template <int Dim, typename Scalar>
+int kdtree<Dim, Scalar>::findpoint(const pointtype &pt) const {
+    /*
+        Index of the tree point with exactly the coordinates of pt, -1 if there is none. When several points share
+        them the lowest index is returned, the others are then duplicates of it.
+    */
+    int v[64];
+    int n = locatenear(pt, 0, v, 64);
+    if (n == 0) return -1;
+    if (n < 64) return *std::min_element(v, v + n);
+    //the buffer may have cut the duplicates short, take all of them
+    std::vector<int> all;
+    locatenear(pt, 0, all);
+    return *std::min_element(all.begin(), all.end());
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::findpoint(const Scalar *qs, int nq, int *idx, int nthreads) const {
+    //findpoint for each of the nq points of qs (Dim values each), in the order of queryorder
+    std::vector<int> order;
+    queryorder(qs, nq, order);
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    #pragma omp parallel for schedule(dynamic, 256) num_threads(nthreads) if(nq > 512)
+#endif
+    for (int iq = 0; iq < nq; iq++) {
+        int i = order.empty() ? iq : order[iq];
+        pointtype pt;
+        pt.set_point(&qs[i*Dim]);
+        idx[i] = findpoint(pt);
+    }
+}
+
+/*
+    dnearest searches the tree from a point that need not belong to it (the translational tree is built from the
+    expanded cluster but searched from the standard cluster). self is the tree index of the query point when it is
+    also in the tree, that point is skipped, and -1 otherwise. nrst receives the index of the neighbour.
+*/
+template <int Dim, typename Scalar>
+Scalar kdtree<Dim, Scalar>::dnearest(const pointtype &pt, int self) const {
+    int nrst;
+    return dnearest(pt, nrst, self);
+}
+
+template <int Dim, typename Scalar>
+Scalar kdtree<Dim, Scalar>::dnearest(const pointtype &pt, int &nrst, int self) const {
+    Scalar dnrst = BIG;
+    nrst = -1;
+    treenearest(pt, self, dnrst, nrst);
+    return sqrt(dnrst);
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::treenearest(const pointtype &pt, int self, Scalar &dnrst, int &nrst) const {
+    int k, kl, ntask;
+    int task[50];
+    kl = locate(pt);
+    scannearest(boxes[kl].ptlo, boxes[kl].pthi, pt, self, dnrst, nrst);
+    task[1] = 0;
+    ntask = 1;
+    while (ntask) {
+        k = task[ntask--];
+        if (k == kl) continue;
+        if (boxdist2(k, pt) < shrink*dnrst) {
+            if (boxes[k].dau1) {
+                task[++ntask] = boxes[k].dau1;
+                task[++ntask] = boxes[k].dau2;
+            }
+            else {
+                scannearest(boxes[k].ptlo, boxes[k].pthi, pt, self, dnrst, nrst);
+            }
+        }
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::treeheap(const pointtype &pt, int self, Scalar *dn, int *nn, int n) const {
+    //dn/nn is a max-heap of n squared distances as in scanheap, entries are only replaced by nearer points
+    int k, kl, ntask;
+    int task[50];
+    kl = locate(pt);
+    scanheap(boxes[kl].ptlo, boxes[kl].pthi, pt, self, dn, nn, n);
+    task[1] = 0;
+    ntask = 1;
+    while (ntask) {
+        k = task[ntask--];
+        if (k == kl) continue;
+        if (boxdist2(k, pt) < shrink*dn[0]) {
+            if (boxes[k].dau1) {
+                task[++ntask] = boxes[k].dau1;
+                task[++ntask] = boxes[k].dau2;
+            }
+            else {
+                scanheap(boxes[k].ptlo, boxes[k].pthi, pt, self, dn, nn, n);
+            }
+        }
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::treegroups(const pointtype &pt, int self, const int *group, int own, Scalar *dg) const {
+    /*
+        dg[g] is the nearest squared distance found so far to a point of group g, entries are only replaced by
+        nearer points. Boxes are pruned on dg[own] alone: the other groups are then exact wherever they are nearer
+        than group own, which is all groupnearest needs.
+    */
+    int k, kl, ntask;
+    int task[50];
+    kl = locate(pt);
+    scangroups(boxes[kl].ptlo, boxes[kl].pthi, pt, self, group, dg);
+    task[1] = 0;
+    ntask = 1;
+    while (ntask) {
+        k = task[ntask--];
+        if (k == kl) continue;
+        if (boxdist2(k, pt) < shrink*dg[own]) {
+            if (boxes[k].dau1) {
+                task[++ntask] = boxes[k].dau1;
+                task[++ntask] = boxes[k].dau2;
+            }
+            else {
+                scangroups(boxes[k].ptlo, boxes[k].pthi, pt, self, group, dg);
+            }
+        }
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::dnearest(const Scalar *qs, int nq, Scalar *dn, int *nn, const int *self, int nthreads) const {
+    /*
+        qs holds nq query points one after the other (Dim values each), dn[i] and nn[i] receive the distance to and
+        the index of the nearest neighbour of query i. self[i] is the tree index query i excludes, or NULL for none.
+        The tree is only read, so the queries run independently, in the order of queryorder.
+    */
+    std::vector<int> order;
+    queryorder(qs, nq, order);
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    #pragma omp parallel for schedule(dynamic, 256) num_threads(nthreads) if(nq > 512)
+#endif
+    for (int iq = 0; iq < nq; iq++) {
+        int i = order.empty() ? iq : order[iq];
+        pointtype pt;
+        pt.set_point(&qs[i*Dim]);
+        dn[i] = dnearest(pt, nn[i], self ? self[i] : -1);
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::groupnearest(const Scalar *qs, int nq, const int *group, int ngroup, const int *own,
+                                       Scalar *dblock, Scalar *dprefix, const int *self, int nthreads) const {
+    /*
+        The points of the tree are split into ngroup groups, group[i] = 0..ngroup-1 for tree point i, as the
+        frames of a trajectory into consecutive blocks; query i belongs to group own[i]. dblock[i] receives the
+        distance from query i to the nearest point of its own group and dprefix[i*ngroup + p], for p >= own[i], to
+        the nearest point of groups 0..p (entries p < own[i] are left alone). A single search per query serves
+        every block and prefix: the prefixes only need the groups where they are nearer than the own group.
+        sqrt(BIG) stands for no point. self[i] is the tree index query i excludes, or NULL for none.
+    */
+    std::vector<int> order;
+    queryorder(qs, nq, order);
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    #pragma omp parallel for schedule(dynamic, 256) num_threads(nthreads) if(nq > 512)
+#endif
+    for (int iq = 0; iq < nq; iq++) {
+        int i = order.empty() ? iq : order[iq];
+        pointtype pt;
+        pt.set_point(&qs[i*Dim]);
+        std::vector<Scalar> dg(ngroup, BIG);
+        treegroups(pt, self ? self[i] : -1, group, own[i], &dg[0]);
+        dblock[i] = sqrt(dg[own[i]]);
+        Scalar d = BIG;
+        for (int p = 0; p < ngroup; p++) {
+            d = std::min(d, dg[p]);
+            if (p >= own[i]) dprefix[i*ngroup + p] = sqrt(d);
+        }
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::queryorder(const Scalar *qs, int nq, std::vector<int> &order) const {
+    /*
+        Order in which the batch searches take their queries: along a Morton curve, so that consecutive queries
+        walk the same boxes and leaves while they are still in cache. Left empty (input order) when zorder is off
+        or the batch is too small for the sort to pay off. The results still go to the slot of each query.
+    */
+    order.clear();
+    if (!zorder || nq <= 1024) return;
+    order.resize(nq);
+    kdmorton<Dim, Scalar>(qs, nq, &order[0]);
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::knearest(const Scalar *qs, int nq, int k, int *nn, Scalar *dn, const int *self,
+                                   int nthreads) const {
+    /*
+        One heap search per query for all of its k nearest neighbours, the heap is sorted afterwards. self[i] is
+        the tree index query i excludes, or NULL for none.
+    */
+    if (k > npts - (self ? 1 : 0)) throw("you're asking for too much buddy (nn > npts)");
+    std::vector<int> order;
+    queryorder(qs, nq, order);
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    #pragma omp parallel for schedule(dynamic, 256) num_threads(nthreads) if(nq > 512)
+#endif
+    for (int iq = 0; iq < nq; iq++) {
+        int i = order.empty() ? iq : order[iq];
+        pointtype pt;
+        pt.set_point(&qs[i*Dim]);
+        Scalar *hd = &dn[i*k];
+        int *hn = &nn[i*k];
+        for (int j = 0; j < k; j++) hd[j] = BIG;
+        treeheap(pt, self ? self[i] : -1, hd, hn, k);
+        //pop the max-heap from the back, the nearest ends up first
+        for (int j = k - 1; j > 0; j--) {
+            std::swap(hd[0], hd[j]);
+            std::swap(hn[0], hn[j]);
+            sift_down(hd, hn, j);
+        }
+        for (int j = 0; j < k; j++) hd[j] = sqrt(hd[j]);
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::nnearest(const int *jpts, int nq, int *nn, Scalar *dn, int n, int nthreads) const {
+    /*
+        n nearest neighbours of each of the tree points jpts[0..nq-1], the neighbours of jpts[i] are written to
+        nn[i*n..i*n+n-1] and dn[i*n..i*n+n-1] in the same heap order as nnearest. The points are taken in tree
+        order, which is already spatially coherent, rather than along a separate curve.
+    */
+    if (n > npts-1) throw("you're asking for too much buddy (nn > npts)");
+    std::vector<std::pair<int, int> > order;
+    if (zorder && nq > 1024) {
+        order.resize(nq);
+        for (int i = 0; i < nq; i++) order[i] = std::make_pair(rptindx[jpts[i]], i);
+        std::sort(order.begin(), order.end());
+    }
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    #pragma omp parallel for schedule(dynamic, 256) num_threads(nthreads) if(nq > 512)
+#endif
+    for (int iq = 0; iq < nq; iq++) {
+        int i = order.empty() ? iq : order[iq].second;
+        nnearest(jpts[i], &nn[i*n], &dn[i*n], n);
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::nnearest(int jpt, int* nn, Scalar* dn, int n) const {
+    int i, k, ntask, kp;
+    int task[50];
+    pointtype pt;
+    if (n > npts-1) throw("you're asking for too much buddy (nn > npts)");
+    for (i = 0; i < n; i++) dn[i] = BIG;
+    getpoint(jpt, pt);
+    //start from the smallest box around jpt that holds n other points, the leaf itself when the buckets are large
+    kp = locate(jpt);
+    while (boxes[kp].pthi - boxes[kp].ptlo < n) kp = boxes[kp].mom;
+    scanheap(boxes[kp].ptlo, boxes[kp].pthi, pt, jpt, dn, nn, n);
+    task[1] = 0;
+    ntask = 1;
+    while (ntask) {
+        k = task[ntask--];
+        if (k == kp) continue;
+        if (boxdist2(k, pt) < shrink*dn[0]) {
+            if (boxes[k].dau1) {
+                task[++ntask] = boxes[k].dau1;
+                task[++ntask] = boxes[k].dau2;
+            }
+            else {
+                scanheap(boxes[k].ptlo, boxes[k].pthi, pt, jpt, dn, nn, n);
+            }
+        }
+    }
+    for (i = 0; i < n; i++) dn[i] = sqrt(dn[i]);
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::scannearest(int jlo, int jhi, const pointtype &pt, int self, Scalar &dnrst, int &nrst) const {
+    Scalar d2[BLOCK];
+    for (int j0 = jlo; j0 <= jhi; j0 += BLOCK) {
+        int nblk = std::min(int(BLOCK), jhi - j0 + 1);
+        kdsimd<Dim, Scalar>::dist2(&coord[j0], npts, nblk, pt.x, periodic ? period.x : NULL, d2);
+        for (int j = 0; j < nblk; j++) {
+            if (d2[j] < dnrst && ptindx[j0 + j] != self && (!mask || mask[ptindx[j0 + j]])) {
+                nrst = ptindx[j0 + j];
+                dnrst = d2[j];
+            }
+        }
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::scanheap(int jlo, int jhi, const pointtype &pt, int self, Scalar *dn, int *nn, int n) const {
+    //dn[0..n-1] and nn[0..n-1] are a max-heap of the n nearest squared distances found so far
+    Scalar d2[BLOCK];
+    for (int j0 = jlo; j0 <= jhi; j0 += BLOCK) {
+        int nblk = std::min(int(BLOCK), jhi - j0 + 1);
+        kdsimd<Dim, Scalar>::dist2(&coord[j0], npts, nblk, pt.x, periodic ? period.x : NULL, d2);
+        for (int j = 0; j < nblk; j++) {
+            if (d2[j] < dn[0] && ptindx[j0 + j] != self && (!mask || mask[ptindx[j0 + j]])) {
+                dn[0] = d2[j];
+                nn[0] = ptindx[j0 + j];
+                if (n > 1) sift_down(dn, nn, n);
+            }
+        }
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::scangroups(int jlo, int jhi, const pointtype &pt, int self, const int *group, Scalar *dg) const {
+    //dg[g] is the nearest squared distance to a point of group g found so far
+    Scalar d2[BLOCK];
+    for (int j0 = jlo; j0 <= jhi; j0 += BLOCK) {
+        int nblk = std::min(int(BLOCK), jhi - j0 + 1);
+        kdsimd<Dim, Scalar>::dist2(&coord[j0], npts, nblk, pt.x, periodic ? period.x : NULL, d2);
+        for (int j = 0; j < nblk; j++) {
+            int i = ptindx[j0 + j];
+            if (d2[j] < dg[group[i]] && i != self && (!mask || mask[i])) dg[group[i]] = d2[j];
+        }
+    }
+}
+
+template <int Dim, typename Scalar>
+Scalar kdtree<Dim, Scalar>::nodedist2(int kq, int kr) const {
+    //squared distance between the tight bounds of boxes kq and kr, 0 when they overlap
+    Scalar d = 0;
+    for (int i = 0; i < Dim; i++) {
+        Scalar lo1 = blo[kq].x[i], hi1 = bhi[kq].x[i], lo2 = blo[kr].x[i], hi2 = bhi[kr].x[i], L = period.x[i], t = 0;
+        if (L == 0) {
+            if (lo2 > hi1) t = lo2 - hi1;
+            else if (lo1 > hi2) t = lo1 - hi2;
+        }
+        else if (hi1 - lo1 + hi2 - lo2 < L) {
+            //c is how far the image of lo2 just above lo1 lies beyond lo1, the gaps are measured both ways round
+            Scalar c = lo2 - lo1;
+            c -= L*floor(c/L);
+            Scalar up = c - (hi1 - lo1), down = L - c - (hi2 - lo2);
+            if (up > 0 && down > 0) t = std::min(up, down);
+        }
+        d += t*t;
+    }
+    return d;
+}
+
+template <int Dim, typename Scalar>
+Scalar kdtree<Dim, Scalar>::pointdist2(int kr, const pointtype &pt) const {
+    //squared distance from pt to the tight bounds of box kr
+    Scalar d = 0;
+    for (int i = 0; i < Dim; i++) {
+        Scalar lo = blo[kr].x[i], hi = bhi[kr].x[i], q = pt.x[i], L = period.x[i], t = 0;
+        if (L == 0) {
+            if (q < lo) t = lo - q;
+            else if (q > hi) t = q - hi;
+        }
+        else if (hi - lo < L) {
+            Scalar a = q - lo;
+            a -= L*floor(a/L);
+            if (a > hi - lo) t = std::min(a - (hi - lo), L - a);
+        }
+        d += t*t;
+    }
+    return d;
+}
+
+template <int Dim, typename Scalar>
+Scalar kdtree<Dim, Scalar>::diameter2(int kq) const {
+    //squared diameter of the tight bounds of box kq, no more than half a period along a periodic dimension
+    Scalar d = 0;
+    for (int i = 0; i < Dim; i++) {
+        Scalar t = bhi[kq].x[i] - blo[kq].x[i];
+        if (period.x[i] != 0) t = std::min(t, period.x[i]/2);
+        d += t*t;
+    }
+    return d;
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::dualnearest(int kq, int kr, int k, Scalar *hd, int *hn, Scalar *bound, Scalar *mink,
+                                      int ntask) const {
+    /*
+        Visit the pair made of query box kq and reference box kr. hd and hn hold a max-heap of k squared distances
+        and neighbours for every tree position. bound[kq] is a squared distance no point of kq needs to look beyond:
+        the largest heap top inside kq, or the smallest one (mink[kq]) widened by the diameter of kq, since every
+        point of kq has the neighbours of any other point of kq within that distance. Pairs are dropped at shrink
+        times the bound, the widened part is divided by shrink beforehand: it bounds the true k-th distances rather
+        than what the heaps hold, and must not be shrunk for the 1 + eps guarantee to hold. Only the recursion on kq
+        writes to the heaps and bounds of kq, so the two halves of a split query box run as separate tasks.
+    */
+    if (nodedist2(kq, kr) >= shrink*bound[kq]) return;
+    int q1 = boxes[kq].dau1, q2 = boxes[kq].dau2, r1 = boxes[kr].dau1, r2 = boxes[kr].dau2;
+    if (!q1 && !r1) {
+        Scalar bmax = 0, bmin = BIG;
+        pointtype pt;
+        for (int j = boxes[kq].ptlo; j <= boxes[kq].pthi; j++) {
+            for (int d = 0; d < Dim; d++) pt.x[d] = coord[d*npts + j];
+            if (pointdist2(kr, pt) < shrink*hd[j*k]) {
+                scanheap(boxes[kr].ptlo, boxes[kr].pthi, pt, ptindx[j], &hd[j*k], &hn[j*k], k);
+            }
+            bmax = std::max(bmax, hd[j*k]);
+            bmin = std::min(bmin, hd[j*k]);
+        }
+        mink[kq] = bmin;
+        bound[kq] = std::min(bmax, widen(bmin, diameter2(kq))/shrink);
+        return;
+    }
+    int nq = boxes[kq].pthi - boxes[kq].ptlo + 1, nr = boxes[kr].pthi - boxes[kr].ptlo + 1;
+    if (q1 && (!r1 || nq >= nr)) {
+#ifdef _OPENMP
+        #pragma omp task if(nq >= 2*ntask) firstprivate(q1, kr, k, hd, hn, bound, mink, ntask)
+#endif
+        dualnearest(q1, kr, k, hd, hn, bound, mink, ntask);
+        dualnearest(q2, kr, k, hd, hn, bound, mink, ntask);
+#ifdef _OPENMP
+        #pragma omp taskwait
+#endif
+        mink[kq] = std::min(mink[q1], mink[q2]);
+        bound[kq] = std::min(std::max(bound[q1], bound[q2]), widen(mink[kq], diameter2(kq))/shrink);
+    }
+    else {
+        //nearer half of the reference box first, so that the farther one is more likely to be pruned
+        if (nodedist2(kq, r2) < nodedist2(kq, r1)) std::swap(r1, r2);
+        dualnearest(kq, r1, k, hd, hn, bound, mink, ntask);
+        dualnearest(kq, r2, k, hd, hn, bound, mink, ntask);
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::all_nearest(int k, int *nn, Scalar *dn, int nthreads, int ntask) const {
+    /*
+        Dual-tree all k nearest neighbours of the points of the tree, the self-join that would otherwise take
+        nnearest(i, ...) for every i. The query boxes are split over nthreads threads (0 for the OpenMP default),
+        ntask being the smallest query subtree handed out as a task.
+    */
+    if (k > npts-1) throw("you're asking for too much buddy (nn > npts)");
+    if (k < 1) return;
+    std::vector<Scalar> hd(npts*k, BIG), bound(numbox, BIG), mink(numbox, BIG);
+    std::vector<int> hn(npts*k, -1);
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    if (nthreads > 1 && npts >= 2*ntask && !omp_in_parallel()) {
+        #pragma omp parallel num_threads(nthreads)
+        {
+            #pragma omp single
+            dualnearest(0, 0, k, &hd[0], &hn[0], &bound[0], &mink[0], ntask);
+        }
+    }
+    else {
+        dualnearest(0, 0, k, &hd[0], &hn[0], &bound[0], &mink[0], ntask);
+    }
+#else
+    dualnearest(0, 0, k, &hd[0], &hn[0], &bound[0], &mink[0], ntask);
+#endif
+    std::vector<std::pair<Scalar, int> > row(k);
+    for (int j = 0; j < npts; j++) {
+        for (int i = 0; i < k; i++) row[i] = std::make_pair(hd[j*k + i], hn[j*k + i]);
+        std::sort(row.begin(), row.end());
+        int ip = ptindx[j];
+        for (int i = 0; i < k; i++) {
+            dn[ip*k + i] = sqrt(row[i].first);
+            nn[ip*k + i] = row[i].second;
+        }
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::sift_down(Scalar* heap, int* ndx, int nn) {
+    int n = nn - 1;
+    int j, jold, ia;
+    Scalar a;
+    a = heap[0];
+    ia = ndx[0];
+    jold = 0;
+    j = 1;
+    while (j <= n) {
+        if (j < n && heap[j] < heap[j+1]) j++;
+        if (a >= heap[j]) break;
+        heap[jold] = heap[j];
+        ndx[jold] = ndx[j];
+        jold = j;
+        j = 2*j+1;
+    }
+    heap[jold] = a;
+    ndx[jold] = ia;
+}
+
+template <int Dim, typename Scalar>
+int kdtree<Dim, Scalar>::locatenear(const pointtype &pt, Scalar r, int *v, int nmax) const {
+    /*
+        This fuction returns all the points within some distance of a target point, at most nmax of them. The
+        vector version below has no such limit.
+    */
+    int k, i, nb, nbold, nret, ntask, jdim, d1, d2;
+    int task[50];
+    Scalar r2 = r*r;
+    Scalar dd[BLOCK];
+    nb = jdim = nret = 0;
+    if (r < 0.0) throw("radius must be nonnegative");
+    while (boxes[nb].dau1 && !periodic) {
+        //points equal to the split value can sit in either daughter, so only a strict inequality rules one out
+        nbold = nb;
+        d1 = boxes[nb].dau1;
+        d2 = boxes[nb].dau2;
+        if (pt.x[jdim] + r < boxes[d1].hi.x[jdim]) nb = d1;
+        else if (pt.x[jdim] - r > boxes[d2].lo.x[jdim]) nb = d2;
+        jdim = (jdim+1)%Dim;
+        if (nb == nbold) break;
+    }
+    task[1] = nb;
+    ntask = 1;
+    while (ntask) {
+        k = task[ntask--];
+        if (boxdist2(k, pt) > r2) continue;
+        if (boxes[k].dau1) {
+            task[++ntask] = boxes[k].dau1;
+            task[++ntask] = boxes[k].dau2;
+        }
+        else {
+            for (int j0 = boxes[k].ptlo; j0 <= boxes[k].pthi; j0 += BLOCK) {
+                int nblk = std::min(int(BLOCK), boxes[k].pthi - j0 + 1);
+                kdsimd<Dim, Scalar>::dist2(&coord[j0], npts, nblk, pt.x, periodic ? period.x : NULL, dd);
+                for (i = 0; i < nblk; i++) {
+                    if (dd[i] <= r2 && nret < nmax && (!mask || mask[ptindx[j0 + i]])) {
+                        v[nret++] = ptindx[j0 + i];
+                    }
+                    if (nret == nmax) return nmax;
+                }
+            }
+        }
+    }
+    return nret;
+}
+
+template <int Dim, typename Scalar>
+Scalar kdtree<Dim, Scalar>::farthest2(int k, const pointtype &pt) const {
+    //squared distance from pt to the farthest corner of the tight bounds of box k, by minimum image when periodic
+    Scalar d = 0;
+    for (int i = 0; i < Dim; i++) {
+        Scalar lo = blo[k].x[i], hi = bhi[k].x[i], q = pt.x[i], L = period.x[i], t;
+        if (L == 0) t = std::max(q - lo, hi - q);
+        else {
+            //the box reaches half a period away when the point opposite q on the circle lies in [lo, hi]
+            Scalar a = q + L/2 - lo;
+            a -= L*floor(a/L);
+            if (a <= hi - lo) t = L/2;
+            else t = std::max(fabs(kdsimd_image(lo - q, L)), fabs(kdsimd_image(hi - q, L)));
+        }
+        d += t*t;
+    }
+    return d;
+}
+
+template <int Dim, typename Scalar>
+int kdtree<Dim, Scalar>::radius(const pointtype &pt, Scalar r, std::vector<int> *v) const {
+    /*
+        Number of points within r of pt, appended to v unless it is NULL. Boxes whose tight bounds miss the sphere
+        are skipped, and when only counting, boxes that lie inside the sphere are counted whole without looking at
+        their points (not with a mask, hidden points would be counted too). The stack never holds more than one
+        box per level of the tree plus one.
+    */
+    if (r < 0.0) throw("radius must be nonnegative");
+    Scalar r2 = r*r;
+    Scalar dd[BLOCK];
+    int task[64];
+    int k, ntask = 1, nret = 0;
+    task[1] = 0;
+    while (ntask) {
+        k = task[ntask--];
+        if (pointdist2(k, pt) > r2) continue;
+        if (!v && !mask && farthest2(k, pt) <= r2) {
+            nret += boxes[k].pthi - boxes[k].ptlo + 1;
+        }
+        else if (boxes[k].dau1) {
+            task[++ntask] = boxes[k].dau1;
+            task[++ntask] = boxes[k].dau2;
+        }
+        else {
+            for (int j0 = boxes[k].ptlo; j0 <= boxes[k].pthi; j0 += BLOCK) {
+                int nblk = std::min(int(BLOCK), boxes[k].pthi - j0 + 1);
+                kdsimd<Dim, Scalar>::dist2(&coord[j0], npts, nblk, pt.x, periodic ? period.x : NULL, dd);
+                for (int i = 0; i < nblk; i++) {
+                    if (dd[i] <= r2 && (!mask || mask[ptindx[j0 + i]])) {
+                        if (v) v->push_back(ptindx[j0 + i]);
+                        nret++;
+                    }
+                }
+            }
+        }
+    }
+    return nret;
+}
+
+template <int Dim, typename Scalar>
+int kdtree<Dim, Scalar>::locatenear(const pointtype &pt, Scalar r, std::vector<int> &v) const {
+    //every point within r of pt into v, in no particular order, returns how many there are
+    v.clear();
+    return radius(pt, r, &v);
+}
+
+template <int Dim, typename Scalar>
+int kdtree<Dim, Scalar>::countnear(const pointtype &pt, Scalar r) const {
+    return radius(pt, r, NULL);
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::countnear(const Scalar *qs, int nq, Scalar r, int *counts, int nthreads) const {
+    //counts[i] receives the number of points within r of query i, the queries are laid out as for the batch dnearest
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+    #pragma omp parallel for schedule(dynamic, 256) num_threads(nthreads) if(nq > 512)
+#endif
+    for (int i = 0; i < nq; i++) {
+        pointtype pt;
+        pt.set_point(&qs[i*Dim]);
+        counts[i] = radius(pt, r, NULL);
+    }
+}
+
+/*
+    Digamma function at a positive integer, psi(k) = -gamma + 1 + 1/2 + ... + 1/(k-1). The k-th nearest neighbour
+    entropy estimators (Kozachenko and Leonenko) subtract psi(k) where the nearest neighbour one adds gamma.
+*/
+inline double kddigamma(int k) {
+    double psi = -0.5772156649;
+    for (int j = 1; j < k; j++) psi += 1.0/j;
+    return psi;
+}
+
+template <int Dim, typename Scalar>
+double kdtree<Dim, Scalar>::run_tree_trans(const std::vector<Scalar> &cls, double *dist, double *logterm) const {
+    //nearest neighbour distances of the oxygens of the acknowledged standard cluster file, searched in parallel
+    int numvals = cls.size()/3;
+    if (numvals == 0) return NAN;
+    std::vector<Scalar> dh(numvals);
+    std::vector<int> nh(numvals), self(numvals);
+    //a standard cluster water is also in the expanded cluster, it must not be its own neighbour
+    findpoint(&cls[0], numvals, &self[0]);
+    dnearest(&cls[0], numvals, &dh[0], &nh[0], &self[0]);
+
+    double gd = 0;
+    double s = 0.0;
+    double T = 300.;
+    double R = 8.314472;
+    double pi = 3.14159265359;
+
+    int fcount = 10000;
+    int nzero = 0, nnone = 0;
+    const Scalar none = sqrt(BIG);
+
+    for (int i = 0; i < numvals; i++) {
+        if (dist) dist[i] = dh[i];
+        if (dh[i] == 0) {
+            if (logterm) logterm[i] = NAN;
+            nzero++;
+            continue;
+        }
+        //an empty tree, or one holding only the water itself, leaves it without a neighbour
+        if (dh[i] >= none) {
+            if (dist) dist[i] = NAN;
+            if (logterm) logterm[i] = NAN;
+            nnone++;
+            continue;
+        }
+        double lg = log((0.0329223149*fcount*4*pi*double(dh[i])*dh[i]*dh[i])/3);
+        if (logterm) logterm[i] = lg;
+        gd += lg;
+    }
+    if (nzero) std::cerr << "run_tree_trans: " << nzero << " waters have a duplicate at distance 0, left out of the entropy" << std::endl;
+    if (nzero + nnone == numvals) return NAN;
+
+    s = R*T*0.239*(gd/(numvals-nzero-nnone) + 0.5772156649)/1000;
+    return s;
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::run_tree_trans(const std::vector<Scalar> &cls, int kmax, double *s, double *dist,
+                                         double *logterm) const {
+    /*
+        One heap search per oxygen finds all kmax neighbours, s[k-1] = R T (<log(rho N 4/3 pi d_k^3)> - psi(k))
+        with d_k the distance to the k-th one. s[0] is what run_tree_trans(cls) returns. The estimates for k
+        beyond the number of other waters in the tree, and those where every k-th neighbour is a duplicate at
+        distance 0, are NaN.
+    */
+    int numvals = cls.size()/3;
+    int k = std::min(kmax, npts - 1);
+    if (kmax == 1 && k == 1) {
+        s[0] = run_tree_trans(cls, dist, logterm);
+        return;
+    }
+    std::fill(s, s + kmax, NAN);
+    if (dist) std::fill(dist, dist + numvals*kmax, NAN);
+    if (logterm) std::fill(logterm, logterm + numvals*kmax, NAN);
+    if (numvals == 0 || k < 1) return;
+    std::vector<Scalar> dk(numvals*k);
+    std::vector<int> nk(numvals*k), self(numvals);
+    findpoint(&cls[0], numvals, &self[0]);
+    knearest(&cls[0], numvals, k, &nk[0], &dk[0], &self[0]);
+
+    double T = 300.;
+    double R = 8.314472;
+    double pi = 3.14159265359;
+    int fcount = 10000;
+
+    for (int j = 0; j < k; j++) {
+        double gd = 0;
+        int nzero = 0;
+        for (int i = 0; i < numvals; i++) {
+            double d = dk[i*k + j];
+            if (dist) dist[i*kmax + j] = d;
+            if (d == 0) {
+                nzero++;
+                continue;
+            }
+            double lg = log((0.0329223149*fcount*4*pi*d*d*d)/3);
+            if (logterm) logterm[i*kmax + j] = lg;
+            gd += lg;
+        }
+        if (nzero) std::cerr << "run_tree_trans: " << nzero << " waters have their neighbour " << j+1 << " at distance 0, left out of that entropy" << std::endl;
+        if (nzero < numvals) s[j] = R*T*0.239*(gd/(numvals-nzero) - kddigamma(j+1))/1000;
+    }
+}
+
+template <int Dim, typename Scalar>
+double kdtree<Dim, Scalar>::run_tree_orient(double *dist, double *logterm) const {
+    double gd = 0;
+    double s = 0.0;
+    double T = 300.;
+    double R = 8.314472;
+    double pi = 3.14159265359;
+
+    //a single water has no neighbour
+    if (npts < 2) {
+        if (dist) std::fill(dist, dist + npts, NAN);
+        if (logterm) std::fill(logterm, logterm + npts, NAN);
+        return NAN;
+    }
+    //the two wrapped angles are periodic in the tree, one search finds the nearest neighbour on the torus
+    std::vector<int> nd(npts);
+    std::vector<Scalar> dn(npts);
+    all_nearest(1, &nd[0], &dn[0]);
+
+    int nzero = 0;
+    for (int i = 0; i < npts; i++) {
+        if (dist) dist[i] = dn[i];
+        if (dn[i] == 0) {
+            if (logterm) logterm[i] = NAN;
+            nzero++;
+            continue;
+        }
+        double lg = log((double(dn[i])*dn[i]*dn[i]*npts)/(6*pi));
+        if (logterm) logterm[i] = lg;
+        gd += lg;
+    }
+    if (nzero) std::cerr << "run_tree_orient: " << nzero << " waters have a duplicate orientation at distance 0, left out of the entropy" << std::endl;
+    if (nzero == npts) return NAN;
+    s = R*T*0.239*(gd/(npts-nzero) + 0.5772156649)/1000;
+    return s;
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::run_tree_orient(int kmax, double *s, double *dist, double *logterm) const {
+    //as run_tree_orient for k = 1..kmax from a single all_nearest pass, estimates beyond npts-1 neighbours are NaN
+    int k = std::min(kmax, npts - 1);
+    if (kmax == 1 && k == 1) {
+        s[0] = run_tree_orient(dist, logterm);
+        return;
+    }
+    double T = 300.;
+    double R = 8.314472;
+    double pi = 3.14159265359;
+
+    std::fill(s, s + kmax, NAN);
+    if (dist) std::fill(dist, dist + npts*kmax, NAN);
+    if (logterm) std::fill(logterm, logterm + npts*kmax, NAN);
+    if (k < 1) return;
+    std::vector<int> nd(npts*k);
+    std::vector<Scalar> dn(npts*k);
+    all_nearest(k, &nd[0], &dn[0]);
+
+    for (int j = 0; j < k; j++) {
+        double gd = 0;
+        int nzero = 0;
+        for (int i = 0; i < npts; i++) {
+            double d = dn[i*k + j];
+            if (dist) dist[i*kmax + j] = d;
+            if (d == 0) {
+                nzero++;
+                continue;
+            }
+            double lg = log((d*d*d*npts)/(6*pi));
+            if (logterm) logterm[i*kmax + j] = lg;
+            gd += lg;
+        }
+        if (nzero) std::cerr << "run_tree_orient: " << nzero << " waters have their neighbour " << j+1 << " at distance 0, left out of that entropy" << std::endl;
+        if (nzero < npts) s[j] = R*T*0.239*(gd/(npts-nzero) - kddigamma(j+1))/1000;
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::run_tree_trans(const std::vector<Scalar> &cls, const int *clsgroup, const int *group,
+                                         int ngroup, const int *frames, double *sblock, double *sprefix) const {
+    /*
+        run_tree_trans(cls) over windows of the trajectory. The tree points and the oxygens cls are split into
+        ngroup consecutive blocks of frames by group and clsgroup, block j being frames[j] frames long. The whole
+        trajectory counts as the 10000 frames of run_tree_trans and a window as its share of them, so the last
+        prefix is run_tree_trans(cls). A window where no oxygen has a neighbour gets NaN.
+    */
+    int numvals = cls.size()/3;
+    for (int j = 0; j < ngroup; j++) sblock[j] = sprefix[j] = NAN;
+    if (numvals == 0) return;
+    std::vector<Scalar> db(numvals), dp(numvals*ngroup);
+    std::vector<int> self(numvals);
+    findpoint(&cls[0], numvals, &self[0]);
+    groupnearest(&cls[0], numvals, group, ngroup, clsgroup, &db[0], &dp[0], &self[0]);
+
+    double T = 300.;
+    double R = 8.314472;
+    double pi = 3.14159265359;
+    const Scalar none = sqrt(BIG);
+
+    std::vector<double> fcount(ngroup), fprefix(ngroup);
+    double total = 0, upto = 0;
+    for (int j = 0; j < ngroup; j++) total += frames[j];
+    for (int j = 0; j < ngroup; j++) {
+        upto += frames[j];
+        fcount[j] = 10000.0*frames[j]/total;
+        fprefix[j] = 10000.0*upto/total;
+    }
+    std::vector<double> gb(ngroup, 0), gp(ngroup, 0);
+    std::vector<int> nb(ngroup, 0), np(ngroup, 0);
+    for (int i = 0; i < numvals; i++) {
+        int j = clsgroup[i];
+        double d = db[i];
+        if (d != 0 && db[i] < none) {
+            gb[j] += log((0.0329223149*fcount[j]*4*pi*d*d*d)/3);
+            nb[j]++;
+        }
+    }
+    for (int p = 0; p < ngroup; p++) {
+        double fc = fprefix[p];
+        for (int i = 0; i < numvals; i++) {
+            if (clsgroup[i] > p) continue;
+            double d = dp[i*ngroup + p];
+            if (d != 0 && dp[i*ngroup + p] < none) {
+                gp[p] += log((0.0329223149*fc*4*pi*d*d*d)/3);
+                np[p]++;
+            }
+        }
+    }
+    for (int j = 0; j < ngroup; j++) {
+        if (nb[j]) sblock[j] = R*T*0.239*(gb[j]/nb[j] + 0.5772156649)/1000;
+        if (np[j]) sprefix[j] = R*T*0.239*(gp[j]/np[j] + 0.5772156649)/1000;
+    }
+}
+
+template <int Dim, typename Scalar>
+void kdtree<Dim, Scalar>::run_tree_orient(const int *group, int ngroup, double *sblock, double *sprefix) const {
+    //run_tree_orient over the blocks and prefixes of run_tree_trans above, a window counts only its own waters
+    for (int j = 0; j < ngroup; j++) sblock[j] = sprefix[j] = NAN;
+    if (npts == 0) return;
+    std::vector<Scalar> qs(npts*Dim);
+    std::vector<int> self(npts);
+    for (int i = 0; i < npts; i++) {
+        for (int d = 0; d < Dim; d++) qs[i*Dim + d] = coordinate(i, d);
+        self[i] = i;
+    }
+    std::vector<Scalar> db(npts), dp(npts*ngroup);
+    groupnearest(&qs[0], npts, group, ngroup, group, &db[0], &dp[0], &self[0]);
+
+    double T = 300.;
+    double R = 8.314472;
+    double pi = 3.14159265359;
+    const Scalar none = sqrt(BIG);
+
+    std::vector<int> count(ngroup, 0);
+    for (int i = 0; i < npts; i++) count[group[i]]++;
+    std::vector<double> gb(ngroup, 0), gp(ngroup, 0);
+    std::vector<int> nb(ngroup, 0), np(ngroup, 0);
+    for (int i = 0; i < npts; i++) {
+        int j = group[i];
+        double d = db[i];
+        if (d != 0 && db[i] < none) {
+            gb[j] += log((d*d*d*count[j])/(6*pi));
+            nb[j]++;
+        }
+    }
+    int n = 0;
+    for (int p = 0; p < ngroup; p++) {
+        n += count[p];
+        for (int i = 0; i < npts; i++) {
+            if (group[i] > p) continue;
+            double d = dp[i*ngroup + p];
+            if (d != 0 && dp[i*ngroup + p] < none) {
+                gp[p] += log((d*d*d*n)/(6*pi));
+                np[p]++;
+            }
+        }
+    }
+    for (int j = 0; j < ngroup; j++) {
+        if (nb[j]) sblock[j] = R*T*0.239*(gb[j]/nb[j] + 0.5772156649)/1000;
+        if (np[j]) sprefix[j] = R*T*0.239*(gp[j]/np[j] + 0.5772156649)/1000;
+    }
+}
+
+#endif /* KDTREE_H */
@@ -0,0 +1,224 @@
+/*
+ * File:   kdtree_bench.cpp
+ *
+ * Timing harness for kdtree.h. Builds trees over synthetic clouds that look like the ones the entropy code
+ * sees, a 3D water cloud at the density of bulk water and a 3D Euler angle cloud, and times construction and the
+ * nearest neighbour searches for a range of leaf bucket sizes and for each leaf kernel: nnearest for every point,
+ * dnearest for every point with the point itself excluded, and the dual-tree all_nearest. Every search is checked
+ * against brute force on a sample of the queries.
+ *
+ * The streaming part feeds the same clouds in one point at a time, as waters accumulate over the frames of a
+ * trajectory, and looks up the nearest neighbour of every point so far at regular checkpoints. It compares the
+ * kdforest of kdforest.h, grown by inserts, with building a new kdtree at every checkpoint.
+ *
+ * The query order part times batch dnearest over the points in their given order and along the Morton curve the
+ * batch searches sort them by (kdtree::zorder), with the cache misses and references of each run where the kernel
+ * exposes the hardware counters.
+ *
+ * usage: kdtree_bench [npts] [nthreads]
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "kdforest.h"
+
+using namespace std;
+
+static double now_ms() {
+    return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double urand() {
+    return rand()/(RAND_MAX + 1.0);
+}
+
+static vector<double> water_cloud(int n) {
+    //uniform oxygens in a cube holding n waters at 0.0334 waters per cubic angstrom
+    double side = pow(n/0.0334, 1.0/3.0);
+    vector<double> v(3*n);
+    for (int i = 0; i < 3*n; i++) v[i] = side*urand();
+    return v;
+}
+
+static vector<double> euler_cloud(int n) {
+    //the same variables kdhsa102 feeds the orientational tree: sin(theta), phi and psi
+    double pi = 3.14159265359;
+    vector<double> v(3*n);
+    for (int i = 0; i < n; i++) {
+        v[3*i] = 2*urand() - 1;
+        v[3*i+1] = 2*pi*urand() - pi;
+        v[3*i+2] = 2*pi*urand() - pi;
+    }
+    return v;
+}
+
+static bool check(const vector<double> &vals, const vector<double> &dn) {
+    //brute force nearest neighbours of every 97th point
+    int n = vals.size()/3;
+    for (int i = 0; i < n; i += 97) {
+        double best = 1e99;
+        for (int j = 0; j < n; j++) {
+            if (j == i) continue;
+            double d = 0;
+            for (int k = 0; k < 3; k++) d += (vals[3*i+k] - vals[3*j+k])*(vals[3*i+k] - vals[3*j+k]);
+            if (d < best) best = d;
+        }
+        if (fabs(sqrt(best) - dn[i]) > 1e-12) return false;
+    }
+    return true;
+}
+
+static void run(const char *name, const vector<double> &vals, int bucket, int nthreads, const char *kernel) {
+    int n = vals.size()/3;
+    vector<int> ids(n), nn(n), self(n);
+    vector<double> dn(n), de(n), da(n);
+    for (int i = 0; i < n; i++) ids[i] = self[i] = i;
+
+    double t0 = now_ms();
+    kdtree<3> tree(vals, bucket, nthreads);
+    double t1 = now_ms();
+    tree.nnearest(&ids[0], n, &nn[0], &dn[0], 1, nthreads);
+    double t2 = now_ms();
+    tree.dnearest(&vals[0], n, &de[0], &nn[0], &self[0], nthreads);
+    double t3 = now_ms();
+    tree.all_nearest(1, &nn[0], &da[0], nthreads);
+    double t4 = now_ms();
+    bool ok = check(vals, dn) && check(vals, de) && check(vals, da);
+    printf("%-6s %6d %6s %8d %10.1f %12.1f %12.1f %12.1f %6s\n", name, bucket, kernel, tree.numbox, t1 - t0, t2 - t1,
+           t3 - t2, t4 - t3, ok ? "ok" : "WRONG");
+}
+
+static void stream(const char *name, const vector<double> &vals, int every, int nthreads) {
+    //checkpoint every `every` points: nearest neighbour of all the points inserted so far, each excluding itself
+    int n = vals.size()/3;
+    vector<int> self(n), nn(n);
+    vector<double> df(n), dt(n);
+    for (int i = 0; i < n; i++) self[i] = i;
+    double tins = 0, tfq = 0, tbuild = 0, ttq = 0;
+    int ncheck = 0;
+    bool ok = true;
+    kdforest<3> forest(KDBUCKET, nthreads);
+    for (int m = every; m <= n; m += every) {
+        double t0 = now_ms();
+        for (int i = m - every; i < m; i++) forest.insert(&vals[3*i]);
+        double t1 = now_ms();
+        forest.dnearest(&vals[0], m, &df[0], &nn[0], &self[0], nthreads);
+        double t2 = now_ms();
+        kdtree<3> tree(vector<double>(vals.begin(), vals.begin() + 3*m), KDBUCKET, nthreads);
+        double t3 = now_ms();
+        tree.dnearest(&vals[0], m, &dt[0], &nn[0], &self[0], nthreads);
+        double t4 = now_ms();
+        tins += t1 - t0;
+        tfq += t2 - t1;
+        tbuild += t3 - t2;
+        ttq += t4 - t3;
+        ncheck++;
+        for (int i = 0; i < m; i++) if (df[i] != dt[i]) ok = false;
+    }
+    printf("%-6s %8d %6d %6d %10.1f %12.1f %12.1f %12.1f %6s\n", name, every, ncheck, forest.ntrees(), tins, tfq, tbuild,
+           ttq, ok ? "ok" : "WRONG");
+}
+
+static int cache_counter(unsigned long long config) {
+    //file descriptor of a hardware counter for this process, -1 if there is none (containers, virtual machines)
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void ordered(const char *name, const vector<double> &vals, int nthreads) {
+    int n = vals.size()/3;
+    vector<int> self(n), nn(n);
+    vector<double> dn(n), dz(n);
+    for (int i = 0; i < n; i++) self[i] = i;
+    kdtree<3> tree(vals, KDBUCKET, nthreads);
+    for (int z = 0; z < 2; z++) {
+        tree.zorder = z;
+        vector<double> &d = z ? dz : dn;
+        int fd[2] = {cache_counter(PERF_COUNT_HW_CACHE_MISSES), cache_counter(PERF_COUNT_HW_CACHE_REFERENCES)};
+        long long count[2] = {-1, -1};
+#ifdef __linux__
+        for (int k = 0; k < 2; k++) if (fd[k] >= 0) ioctl(fd[k], PERF_EVENT_IOC_RESET, 0), ioctl(fd[k], PERF_EVENT_IOC_ENABLE, 0);
+#endif
+        double t0 = now_ms();
+        tree.dnearest(&vals[0], n, &d[0], &nn[0], &self[0], nthreads);
+        double t1 = now_ms();
+#ifdef __linux__
+        for (int k = 0; k < 2; k++) {
+            if (fd[k] < 0) continue;
+            ioctl(fd[k], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd[k], &count[k], sizeof(count[k])) != sizeof(count[k])) count[k] = -1;
+            close(fd[k]);
+        }
+#endif
+        char miss[32] = "-", ref[32] = "-";
+        if (count[0] >= 0) snprintf(miss, sizeof(miss), "%lld", count[0]);
+        if (count[1] >= 0) snprintf(ref, sizeof(ref), "%lld", count[1]);
+        printf("%-6s %6s %12.1f %14s %14s %6s\n", name, z ? "morton" : "given", t1 - t0, miss, ref,
+               z && dz != dn ? "WRONG" : "ok");
+    }
+}
+
+int main(int argc, char** argv) {
+    int npts = argc > 1 ? atoi(argv[1]) : 200000;
+    int nthreads = argc > 2 ? atoi(argv[2]) : 1;
+    const char *kernels[] = {"none", "sse2", "avx2"};
+    int buckets[] = {4, 8, 16, 32, 64, 128, 256};
+    int best = kdsimd_level();
+
+    srand(1);
+    vector<double> water = water_cloud(npts);
+    vector<double> euler = euler_cloud(npts);
+
+    printf("%d points, %d threads, times in ms\n", npts, nthreads);
+    printf("%-6s %6s %6s %8s %10s %12s %12s %12s %6s\n", "cloud", "bucket", "kernel", "boxes", "build", "nnearest", "dnearest",
+           "all_nearest", "check");
+    for (int c = 0; c < 2; c++) {
+        const char *name = c ? "euler" : "water";
+        const vector<double> &vals = c ? euler : water;
+        for (unsigned b = 0; b < sizeof(buckets)/sizeof(buckets[0]); b++) {
+            run(name, vals, buckets[b], nthreads, kernels[best]);
+        }
+        for (int level = KDSIMD_NONE; level < best; level++) {
+            kdsimd_set_level(level);
+            run(name, vals, KDBUCKET, nthreads, kernels[level]);
+        }
+        kdsimd_set_level(best);
+    }
+
+    printf("\nstreaming inserts, times in ms summed over the checkpoints\n");
+    printf("%-6s %8s %6s %6s %10s %12s %12s %12s %6s\n", "cloud", "every", "checks", "trees", "insert", "forest query",
+           "rebuild", "tree query", "check");
+    int everys[] = {npts/100, npts/10};
+    for (int c = 0; c < 2; c++) {
+        for (int e = 0; e < 2; e++) {
+            if (everys[e] > 0) stream(c ? "euler" : "water", c ? euler : water, everys[e], nthreads);
+        }
+    }
+
+    printf("\nbatch dnearest query order, times in ms\n");
+    printf("%-6s %6s %12s %14s %14s %6s\n", "cloud", "order", "dnearest", "cache misses", "cache refs", "check");
+    ordered("water", water, nthreads);
+    ordered("euler", euler, nthreads);
+    return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * File:   kdtree_simd.h
+ *
+ * Leaf kernels for kdtree.h. kdsimd<Dim, Scalar>::dist2(c, stride, n, q, per, out) writes the squared distances
+ * from q to n consecutive points to out, coordinate d of point i being c[d*stride + i]. per is NULL or holds the
+ * period of every dimension (0 for an open one), periodic differences are taken to their minimum image.
+ *
+ * On x86 the double and float kernels come in AVX2 and SSE2 flavours compiled through target attributes, the
+ * one to use is picked when the first leaf is scanned from what the CPU reports, so the extensions need no
+ * -mavx2 and still run on older machines. Every flavour sums the terms in the same order as kdunroll, the
+ * distances are bit for bit the same whichever kernel runs.
+ */
+
+#ifndef KDTREE_SIMD_H
+#define KDTREE_SIMD_H
+#include <math.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KDSIMD_X86
+#include <immintrin.h>
+#endif
+
+enum { KDSIMD_NONE = 0, KDSIMD_SSE2 = 1, KDSIMD_AVX2 = 2 };
+
+inline int kdsimd_detect() {
+#ifdef KDSIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return KDSIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return KDSIMD_SSE2;
+#endif
+    return KDSIMD_NONE;
+}
+
+//instruction set used by the leaf kernels, it can be lowered (not raised above what was detected) to compare them
+inline int &kdsimd_level() {
+    static int level = kdsimd_detect();
+    return level;
+}
+
+inline void kdsimd_set_level(int level) {
+    static const int best = kdsimd_detect();
+    kdsimd_level() = level < best ? level : best;
+}
+
+//minimum image of the difference t in a dimension of period L
+template <typename Scalar>
+inline Scalar kdsimd_image(Scalar t, Scalar L) {
+    return t - L*nearbyint(t/L);
+}
+
+template <int Dim, typename Scalar>
+inline void kdsimd_tail(const Scalar* c, int stride, int i, int n, const Scalar* q, const Scalar* per, Scalar* out) {
+    for (; i < n; i++) {
+        Scalar t = c[(Dim-1)*stride + i] - q[Dim-1];
+        if (per && per[Dim-1] != 0) t = kdsimd_image(t, per[Dim-1]);
+        Scalar acc = t*t;
+        for (int d = Dim-2; d >= 0; d--) {
+            t = c[d*stride + i] - q[d];
+            if (per && per[d] != 0) t = kdsimd_image(t, per[d]);
+            acc = t*t + acc;
+        }
+        out[i] = acc;
+    }
+}
+
+template <int Dim, typename Scalar>
+struct kdsimd {
+    static inline void dist2(const Scalar* c, int stride, int n, const Scalar* q, const Scalar* per, Scalar* out) {
+        kdsimd_tail<Dim, Scalar>(c, stride, 0, n, q, per, out);
+    }
+};
+
+#ifdef KDSIMD_X86
+template <int Dim, bool Wrap>
+struct kdsimd_x86 {
+    /*
+        Minimum images, t - L*round(t/L) with round to nearest even like nearbyint. AVX has a rounding instruction,
+        SSE2 rounds by adding and removing 1.5*2^52 (1.5*2^23 in single precision).
+    */
+    __attribute__((target("avx2")))
+    static inline __m256d image_avx2(__m256d t, __m256d L) {
+        __m256d r = _mm256_round_pd(_mm256_div_pd(t, L), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        return _mm256_sub_pd(t, _mm256_mul_pd(L, r));
+    }
+    __attribute__((target("avx2")))
+    static inline __m256 image_avx2(__m256 t, __m256 L) {
+        __m256 r = _mm256_round_ps(_mm256_div_ps(t, L), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        return _mm256_sub_ps(t, _mm256_mul_ps(L, r));
+    }
+    __attribute__((target("sse2")))
+    static inline __m128d image_sse2(__m128d t, __m128d L) {
+        const __m128d magic = _mm_set1_pd(6755399441055744.0);
+        __m128d r = _mm_sub_pd(_mm_add_pd(_mm_div_pd(t, L), magic), magic);
+        return _mm_sub_pd(t, _mm_mul_pd(L, r));
+    }
+    __attribute__((target("sse2")))
+    static inline __m128 image_sse2(__m128 t, __m128 L) {
+        const __m128 magic = _mm_set1_ps(12582912.0f);
+        __m128 r = _mm_sub_ps(_mm_add_ps(_mm_div_ps(t, L), magic), magic);
+        return _mm_sub_ps(t, _mm_mul_ps(L, r));
+    }
+    __attribute__((target("avx2")))
+    static int dist2_avx2(const double* c, int stride, int n, const double* q, const double* per, double* out) {
+        __m256d qd[Dim], pd[Dim];
+        for (int d = 0; d < Dim; d++) {
+            qd[d] = _mm256_set1_pd(q[d]);
+            pd[d] = _mm256_set1_pd(Wrap ? per[d] : 0);
+        }
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d t = _mm256_sub_pd(_mm256_loadu_pd(c + (Dim-1)*stride + i), qd[Dim-1]);
+            if (Wrap && per[Dim-1] != 0) t = image_avx2(t, pd[Dim-1]);
+            __m256d acc = _mm256_mul_pd(t, t);
+            for (int d = Dim-2; d >= 0; d--) {
+                t = _mm256_sub_pd(_mm256_loadu_pd(c + d*stride + i), qd[d]);
+                if (Wrap && per[d] != 0) t = image_avx2(t, pd[d]);
+                acc = _mm256_add_pd(_mm256_mul_pd(t, t), acc);
+            }
+            _mm256_storeu_pd(out + i, acc);
+        }
+        return i;
+    }
+    __attribute__((target("avx2")))
+    static int dist2_avx2(const float* c, int stride, int n, const float* q, const float* per, float* out) {
+        __m256 qd[Dim], pd[Dim];
+        for (int d = 0; d < Dim; d++) {
+            qd[d] = _mm256_set1_ps(q[d]);
+            pd[d] = _mm256_set1_ps(Wrap ? per[d] : 0);
+        }
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 t = _mm256_sub_ps(_mm256_loadu_ps(c + (Dim-1)*stride + i), qd[Dim-1]);
+            if (Wrap && per[Dim-1] != 0) t = image_avx2(t, pd[Dim-1]);
+            __m256 acc = _mm256_mul_ps(t, t);
+            for (int d = Dim-2; d >= 0; d--) {
+                t = _mm256_sub_ps(_mm256_loadu_ps(c + d*stride + i), qd[d]);
+                if (Wrap && per[d] != 0) t = image_avx2(t, pd[d]);
+                acc = _mm256_add_ps(_mm256_mul_ps(t, t), acc);
+            }
+            _mm256_storeu_ps(out + i, acc);
+        }
+        return i;
+    }
+    __attribute__((target("sse2")))
+    static int dist2_sse2(const double* c, int stride, int n, const double* q, const double* per, double* out) {
+        __m128d qd[Dim], pd[Dim];
+        for (int d = 0; d < Dim; d++) {
+            qd[d] = _mm_set1_pd(q[d]);
+            pd[d] = _mm_set1_pd(Wrap ? per[d] : 0);
+        }
+        int i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d t = _mm_sub_pd(_mm_loadu_pd(c + (Dim-1)*stride + i), qd[Dim-1]);
+            if (Wrap && per[Dim-1] != 0) t = image_sse2(t, pd[Dim-1]);
+            __m128d acc = _mm_mul_pd(t, t);
+            for (int d = Dim-2; d >= 0; d--) {
+                t = _mm_sub_pd(_mm_loadu_pd(c + d*stride + i), qd[d]);
+                if (Wrap && per[d] != 0) t = image_sse2(t, pd[d]);
+                acc = _mm_add_pd(_mm_mul_pd(t, t), acc);
+            }
+            _mm_storeu_pd(out + i, acc);
+        }
+        return i;
+    }
+    __attribute__((target("sse2")))
+    static int dist2_sse2(const float* c, int stride, int n, const float* q, const float* per, float* out) {
+        __m128 qd[Dim], pd[Dim];
+        for (int d = 0; d < Dim; d++) {
+            qd[d] = _mm_set1_ps(q[d]);
+            pd[d] = _mm_set1_ps(Wrap ? per[d] : 0);
+        }
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128 t = _mm_sub_ps(_mm_loadu_ps(c + (Dim-1)*stride + i), qd[Dim-1]);
+            if (Wrap && per[Dim-1] != 0) t = image_sse2(t, pd[Dim-1]);
+            __m128 acc = _mm_mul_ps(t, t);
+            for (int d = Dim-2; d >= 0; d--) {
+                t = _mm_sub_ps(_mm_loadu_ps(c + d*stride + i), qd[d]);
+                if (Wrap && per[d] != 0) t = image_sse2(t, pd[d]);
+                acc = _mm_add_ps(_mm_mul_ps(t, t), acc);
+            }
+            _mm_storeu_ps(out + i, acc);
+        }
+        return i;
+    }
+};
+
+template <int Dim>
+struct kdsimd<Dim, double> {
+    static inline void dist2(const double* c, int stride, int n, const double* q, const double* per, double* out) {
+        int i = 0;
+        int level = kdsimd_level();
+        if (per) {
+            if (level == KDSIMD_AVX2) i = kdsimd_x86<Dim, true>::dist2_avx2(c, stride, n, q, per, out);
+            else if (level == KDSIMD_SSE2) i = kdsimd_x86<Dim, true>::dist2_sse2(c, stride, n, q, per, out);
+        }
+        else {
+            if (level == KDSIMD_AVX2) i = kdsimd_x86<Dim, false>::dist2_avx2(c, stride, n, q, per, out);
+            else if (level == KDSIMD_SSE2) i = kdsimd_x86<Dim, false>::dist2_sse2(c, stride, n, q, per, out);
+        }
+        kdsimd_tail<Dim, double>(c, stride, i, n, q, per, out);
+    }
+};
+
+template <int Dim>
+struct kdsimd<Dim, float> {
+    static inline void dist2(const float* c, int stride, int n, const float* q, const float* per, float* out) {
+        int i = 0;
+        int level = kdsimd_level();
+        if (per) {
+            if (level == KDSIMD_AVX2) i = kdsimd_x86<Dim, true>::dist2_avx2(c, stride, n, q, per, out);
+            else if (level == KDSIMD_SSE2) i = kdsimd_x86<Dim, true>::dist2_sse2(c, stride, n, q, per, out);
+        }
+        else {
+            if (level == KDSIMD_AVX2) i = kdsimd_x86<Dim, false>::dist2_avx2(c, stride, n, q, per, out);
+            else if (level == KDSIMD_SSE2) i = kdsimd_x86<Dim, false>::dist2_sse2(c, stride, n, q, per, out);
+        }
+        kdsimd_tail<Dim, float>(c, stride, i, n, q, per, out);
+    }
+};
+#endif
+
+#endif /* KDTREE_SIMD_H */
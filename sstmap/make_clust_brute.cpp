@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <vector>
 #include <math.h>
+#include "kdtree.h"
+#include "pdbcoords.h"
 
 using namespace std;
 
@@ -55,38 +57,27 @@ int main (int argc, char** argv) {
     }
 
 
-    vector<double > cens;
-    vector<double > wats;
-
-
-    string temp;
-    ifstream cinput(cfile.c_str());
-    getline(cinput, temp); //skip header
-    while (!cinput.eof()) {
-        getline(cinput, temp);
-        if (!temp.empty()) {
-            cens.push_back(atof(temp.substr(31, 7).c_str()));
-            cens.push_back(atof(temp.substr(39, 7).c_str()));
-            cens.push_back(atof(temp.substr(47, 7).c_str()));
-        }
+    //the clusters are written as water containers, with the frames of their waters, when wfile is one
+    vector<double> cens, wats, clwats;
+    vector<int> frames, clframes;
+    bool binary = false;
+    try {
+        cens = pdbread(cfile, true);
+        pdbcoords win(wfile, false);
+        wats = win.coords();
+        binary = win.binary;
+        if (win.frames()) frames.assign(win.frames(), win.frames() + wats.size()/9);
     }
-
-    cinput.close();
-
-    int numclust = cens.size()/3;
-
-    ifstream winput(wfile.c_str());
-    //getline(winput, temp); //skip header
-    while (!winput.eof()) {
-        getline(winput, temp);
-        if (!temp.empty()) {
-            wats.push_back(atof(temp.substr(31, 7).c_str()));
-            wats.push_back(atof(temp.substr(39, 7).c_str()));
-            wats.push_back(atof(temp.substr(47, 7).c_str()));
-        }
+    catch (const char *err) {
+        cerr << err << ": " << cfile << " " << wfile << endl;
+        exit(1);
     }
+    int numclust = cens.size()/3;
 
-    winput.close();
+    //tree of the oxygens, it narrows down the waters that have to be compared with each cluster center
+    kdtree<3> otree(pdboxygens(wats));
+    vector<int> near;
+    point<3> cen;
 
     FILE* pFile;
     char fileName[80];
@@ -101,19 +92,21 @@ int main (int argc, char** argv) {
         val = i+1;
         cout << val << endl;
         if (i < 9) {
-            sprintf(fileName, "cluster.00000%i.pdb", val);
+            sprintf(fileName, "cluster.00000%i.%s", val, binary ? "wat" : "pdb");
             //ss << "cluster.00000" << val << ".pdb";
             //ss >> fileName;
         }
         else if (i < 99){
-            sprintf(fileName, "cluster.0000%i.pdb", val);
+            sprintf(fileName, "cluster.0000%i.%s", val, binary ? "wat" : "pdb");
             //ss << "cluster.0000" << val << ".pdb";
             //ss >> fileName;
         }
 	else {
-	    sprintf(fileName, "cluster.000%i.pdb", val);
+	    sprintf(fileName, "cluster.000%i.%s", val, binary ? "wat" : "pdb");
 	}
-        pFile = fopen(fileName, "w");
+        pFile = binary ? NULL : fopen(fileName, "w");
+        clwats.clear();
+        clframes.clear();
         pos = 0;
         /*for (int j = 0; j < watnum; j++) {
             if (wats[j].numclust != 0) {
@@ -136,9 +129,18 @@ int main (int argc, char** argv) {
 
         //for (int j = 0; j < cens.size(); j+=3) {
         j = i*3;
-            for (int k = 0; k < wats.size(); k+=9) {
+        //a hair wider than the cutoff so that the test below alone decides, the waters are written in input order
+        cen.set_point(&cens[j]);
+        otree.locatenear(cen, 2.0*(1 + 1e-9), near);
+        sort(near.begin(), near.end());
+            for (int n = 0; n < near.size(); n++) {
+                int k = 9*near[n];
                 dist = pow((cens[j] - wats[k]), 2) + pow((cens[j+1] - wats[k+1]), 2) + pow((cens[j+2] - wats[k+2]), 2);
-                if (dist <= 4) {
+                if (dist <= 4 && binary) {
+                    clwats.insert(clwats.end(), wats.begin() + k, wats.begin() + k + 9);
+                    if (!frames.empty()) clframes.push_back(frames[near[n]]);
+                }
+                else if (dist <= 4) {
                     atom = "O";
                     fprintf (pFile, "%-6s%5i %-4s %3s %1s%4i    %8.3f%8.3f%8.3f%6.2f%6.2f\n", name.c_str(), pos, atom.c_str(), resname.c_str(), chainid.c_str(), resseq, wats[k], wats[k+1], wats[k+2], occupancy, T);
                     pos++;
@@ -151,7 +153,17 @@ int main (int argc, char** argv) {
             }
         //}
 
-        fclose(pFile);
+        if (!binary) {
+            fclose(pFile);
+            continue;
+        }
+        try {
+            waterwrite(fileName, clwats, frames.empty() ? NULL : &clframes);
+        }
+        catch (const char *err) {
+            cerr << err << ": " << fileName << endl;
+            exit(1);
+        }
     }
 
 
@@ -0,0 +1,347 @@
+/*
+ * File:   pdbcoords.h
+ *
+ * Reader for the water files the clustering, entropy and probable configuration codes pass around (cluster
+ * centers, standard and expanded clusters, within5Aofligand), either PDB text or the binary water container
+ * below; which one a file is is told from its first bytes, so every entry point taking a file takes both. Only
+ * the coordinates of a PDB file are used, taken as they always have been from the 7 characters at columns 31, 39
+ * and 47 (0 based) of every line.
+ *
+ * The file is mapped read-only and parsed in place, no string is made for a line or a field. It is cut into
+ * chunks at line starts; one pass counts the atom lines of every chunk, the counts give each chunk its first
+ * atom, and a second pass parses every chunk straight into its slots of the caller's buffer, so both passes run
+ * in parallel and the atoms come out in file order for any number of threads. read fills separate x, y and z
+ * arrays or, with a stride of 3 into one array, the point-major layout the trees and the orientation kernel take.
+ *
+ * A field holding a plain decimal number (sign, digits, point, digits, then anything that is not part of a
+ * number) is converted as an integer divided by a power of ten, one correctly rounded division that gives
+ * exactly the double atof gives; anything else goes through strtod. The usual full width field (%8.3f written
+ * by the Python side) takes the integer from one 8 byte word without a loop over its characters. Empty lines are skipped as before, and so
+ * are lines too short to reach the z field (TER and END records), which used to throw out of substr.
+ *
+ * The water container holds the same waters in about a sixth of the bytes and is read without parsing. All of it is
+ * little-endian:
+ *
+ *     offset 0    char     magic[8]       "SSTWATER"
+ *            8    uint32   version        1
+ *           12    uint32   header size    32, the coordinates start there
+ *           16    uint64   n              number of waters
+ *           24    uint32   flags          bit 0 set when frame ids follow the coordinates
+ *           28    uint32   reserved       0
+ *           32    float32  xyz[n][3][3]   O, H1 and H2 of every water, in angstrom
+ *                 int32    frame[n]       frame of every water, counted from the first frame analysed
+ *
+ * and nothing after. utils.write_water_container writes it from NumPy, waterwrite below from here.
+ */
+
+#ifndef PDBCOORDS_H
+#define PDBCOORDS_H
+
+#include <algorithm>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static inline double pdbfield(const char *p, const char *end) {
+    //atof of the characters p..end-1
+    static const double tens[8] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7};
+    const char *q = p;
+    while (q < end && (*q == ' ' || *q == '\t')) q++;
+    bool neg = false;
+    if (q < end && (*q == '-' || *q == '+')) neg = *q++ == '-';
+    long m = 0;
+    int ndig = 0, nfrac = 0;
+    while (q < end && *q >= '0' && *q <= '9') {
+        m = 10*m + (*q++ - '0');
+        ndig++;
+    }
+    if (q < end && *q == '.') {
+        q++;
+        while (q < end && *q >= '0' && *q <= '9') {
+            m = 10*m + (*q++ - '0');
+            ndig++;
+            nfrac++;
+        }
+    }
+    if (ndig > 0 && ndig <= 15 && nfrac < 8 && (q == end || (*q != 'e' && *q != 'E' && *q != 'x' && *q != 'X'))) {
+        double v = m/tens[nfrac];
+        return neg ? -v : v;
+    }
+    char buf[64];
+    size_t n = end - p < 63 ? end - p : 63;
+    memcpy(buf, p, n);
+    buf[n] = 0;
+    return strtod(buf, NULL);
+}
+
+static inline unsigned long long pdbbytes(unsigned long long w, unsigned char c) {
+    //0x80 in every byte of w equal to c
+    unsigned long long x = w ^ (0x0101010101010101ULL*c);
+    return ~(((x & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | x) & 0x8080808080808080ULL;
+}
+
+static inline bool pdbfield7(const char *f, double *v) {
+    /*
+        The common case of a field filling all 7 characters, leading spaces, an optional minus and digits with one
+        point: v receives its value, any other field returns false. The 7 characters are taken as one word and the
+        digits on both sides of the point closed up and converted together, no branch depends on the number. f[-1]
+        is read too, a field never starts a line.
+    */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    static const double tens[8] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7};
+    const unsigned long long H = 0x8080808080808080ULL;
+    unsigned long long w;
+    memcpy(&w, f - 1, 8);
+    w &= ~0xFFULL; //characters in bytes 1..7, the first one the most significant
+    unsigned long long d = w ^ 0x3030303030303030ULL;
+    unsigned long long other = ((((d & 0x7F7F7F7F7F7F7F7FULL) + 0x7676767676767676ULL) | d) & H) & ~0x80ULL;
+    unsigned long long point = pdbbytes(w, '.'), space = pdbbytes(w, ' '), minus = pdbbytes(w, '-');
+    unsigned long long lead = (space >> 7)*0xFF | 0xFF; //byte 0 and the spaces
+    //no other characters, one point, the spaces in front, a minus only right after them and some digit
+    if (other != (point | space | minus) || point == 0 || (point & (point - 1)) != 0 || (lead & (lead + 1)) != 0 ||
+        (minus != 0 && minus != (lead + 1) << 7) || (other | 0x80ULL) == H)
+        return false;
+    int k = __builtin_ctzll(point)/8;
+    unsigned long long low = (1ULL << 8*k) - 1;
+    unsigned long long m = d & ((~other & H & ~0x80ULL) >> 7)*0xFF; //digit values, 0 elsewhere
+    m = ((m & low) << 8) | (m & ~low);
+    m = (m*10 + (m >> 8)) & 0x00FF00FF00FF00FFULL;
+    m = (m*100 + (m >> 16)) & 0x0000FFFF0000FFFFULL;
+    m = (m*10000 + (m >> 32)) & 0xFFFFFFFFULL;
+    double x = (double)m/tens[7 - k];
+    *v = minus ? -x : x;
+    return true;
+#else
+    return false;
+#endif
+}
+
+struct waterheader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headsize;
+    uint64_t nwaters;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+static const char WATERMAGIC[8] = {'S', 'S', 'T', 'W', 'A', 'T', 'E', 'R'};
+static const uint32_t WATERFRAMES = 1; //flag of the frame ids
+
+struct pdbcoords {
+    static const int COL = 31; //first column of the x field, y and z follow 8 columns apart
+    static const int WIDTH = 7;
+    static const int ZCOL = COL + 16;
+    size_t natoms;
+    const char *data; //the mapped file
+    size_t len;
+    size_t body; //offset of the first line after the skipped header
+    std::vector<size_t> chunk; //chunk c is bytes chunk[c]..chunk[c + 1]-1, every one starting a line
+    std::vector<size_t> first; //index of the first atom of every chunk, first.back() == natoms
+    bool binary; //a water container, its coordinates at wxyz and frame ids if any at wframes
+    const float *wxyz;
+    const int32_t *wframes;
+    void *map;
+    pdbcoords(const std::string &file, bool header, int nthreads = 0);
+    ~pdbcoords() { if (map) munmap(map, len); }
+    size_t size() const { return natoms; }
+    //x[i*stride], y[i*stride] and z[i*stride] receive the coordinates of atom i
+    void read(double *x, double *y, double *z, size_t stride, int nthreads = 0) const;
+    std::vector<double> coords(int nthreads = 0) const;
+    //xyz receives the coordinates of the first atom, false when there is none
+    bool front(double *xyz) const;
+    //frame ids of the waters of a water container that has them, NULL otherwise
+    const int32_t *frames() const { return wframes; }
+private:
+    void container();
+    static bool atomline(const char *line, const char *eol) { return eol - line >= ZCOL; }
+    size_t scan(size_t lo, size_t hi, double *x, double *y, double *z, size_t stride, size_t max = -1) const;
+    pdbcoords(const pdbcoords &);
+    pdbcoords &operator=(const pdbcoords &);
+};
+
+inline pdbcoords::pdbcoords(const std::string &file, bool header, int nthreads)
+    : natoms(0), data(NULL), len(0), body(0), binary(false), wxyz(NULL), wframes(NULL), map(NULL) {
+    /*
+        Maps file and counts its atoms, header skips the first line of a PDB file as the getline loops did. Throws
+        when the file cannot be opened or is a damaged water container.
+    */
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) throw("cannot open water file");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw("cannot open water file");
+    }
+    len = st.st_size;
+    if (len > 0) {
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+            close(fd);
+            throw("cannot map water file");
+        }
+        madvise(map, len, MADV_SEQUENTIAL);
+        data = (const char *)map;
+    }
+    close(fd);
+    if (len >= sizeof(waterheader) && !memcmp(data, WATERMAGIC, sizeof(WATERMAGIC))) {
+        container();
+        return;
+    }
+    if (header && len > 0) {
+        const char *eol = (const char *)memchr(data, '\n', len);
+        body = eol ? eol - data + 1 : len;
+    }
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+    //a few chunks a thread to even out the load, none smaller than a megabyte
+    size_t nchunk = std::min((size_t)8*nthreads, (len - body)/(1 << 20) + 1);
+    chunk.push_back(body);
+    for (size_t c = 1; c < nchunk; c++) {
+        size_t at = body + (len - body)*c/nchunk;
+        if (at <= chunk.back()) continue;
+        const char *eol = (const char *)memchr(data + at - 1, '\n', len - at + 1);
+        at = eol ? eol - data + 1 : len;
+        if (at > chunk.back() && at < len) chunk.push_back(at);
+    }
+    chunk.push_back(len);
+    nchunk = chunk.size() - 1;
+    std::vector<size_t> count(nchunk);
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads) if(nchunk > 1)
+    for (long c = 0; c < (long)nchunk; c++) count[c] = scan(chunk[c], chunk[c + 1], NULL, NULL, NULL, 0);
+    first.assign(nchunk + 1, 0);
+    for (size_t c = 0; c < nchunk; c++) first[c + 1] = first[c] + count[c];
+    natoms = first[nchunk];
+}
+
+inline void pdbcoords::container() {
+    //checks the header of a water container against the length of the file
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    throw("water containers are only read on little-endian machines");
+#endif
+    waterheader h;
+    memcpy(&h, data, sizeof(h));
+    if (h.version != 1 || h.headsize < sizeof(h) || h.headsize%4 != 0) throw("unknown water container version");
+    size_t bytes = 36 + (h.flags & WATERFRAMES ? 4 : 0);
+    if (h.headsize > len || h.nwaters != (len - h.headsize)/bytes || (len - h.headsize)%bytes != 0)
+        throw("water container length does not match its header");
+    binary = true;
+    natoms = 3*h.nwaters;
+    wxyz = (const float *)(data + h.headsize);
+    if (h.flags & WATERFRAMES) wframes = (const int32_t *)(wxyz + 9*h.nwaters);
+}
+
+inline size_t pdbcoords::scan(size_t lo, size_t hi, double *x, double *y, double *z, size_t stride,
+                              size_t max) const {
+    //counts the atom lines of bytes lo..hi-1, up to max of them, and parses them into x, y and z unless those are NULL
+    size_t n = 0;
+    const char *p = data + lo, *end = data + hi;
+    while (p < end && n < max) {
+        const char *eol = (const char *)memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+        if (atomline(p, eol)) {
+            if (x) {
+                const char *f = p + COL;
+                if (!pdbfield7(f, &x[n*stride])) x[n*stride] = pdbfield(f, f + WIDTH);
+                f += 8;
+                if (!pdbfield7(f, &y[n*stride])) y[n*stride] = pdbfield(f, f + WIDTH);
+                f += 8;
+                if (f + WIDTH > eol) z[n*stride] = pdbfield(f, eol);
+                else if (!pdbfield7(f, &z[n*stride])) z[n*stride] = pdbfield(f, f + WIDTH);
+            }
+            n++;
+        }
+        p = eol + 1;
+    }
+    return n;
+}
+
+inline void pdbcoords::read(double *x, double *y, double *z, size_t stride, int nthreads) const {
+#ifdef _OPENMP
+    if (nthreads <= 0) nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+    if (binary) {
+        #pragma omp parallel for num_threads(nthreads) if(natoms > 100000)
+        for (long i = 0; i < (long)natoms; i++) {
+            x[i*stride] = wxyz[3*i];
+            y[i*stride] = wxyz[3*i + 1];
+            z[i*stride] = wxyz[3*i + 2];
+        }
+        return;
+    }
+    long nchunk = chunk.size() - 1;
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads) if(nchunk > 1)
+    for (long c = 0; c < nchunk; c++) {
+        size_t a = first[c]*stride;
+        scan(chunk[c], chunk[c + 1], x + a, y + a, z + a, stride);
+    }
+}
+
+inline bool pdbcoords::front(double *xyz) const {
+    if (!binary) return scan(body, len, xyz, xyz + 1, xyz + 2, 0, 1) > 0;
+    if (natoms == 0) return false;
+    for (int d = 0; d < 3; d++) xyz[d] = wxyz[d];
+    return true;
+}
+
+inline std::vector<double> pdbcoords::coords(int nthreads) const {
+    //x y z of every atom, one atom after the other
+    std::vector<double> xyz(3*natoms);
+    if (natoms) read(&xyz[0], &xyz[1], &xyz[2], 3, nthreads);
+    return xyz;
+}
+
+static inline std::vector<double> pdbread(const std::string &file, bool header, int nthreads = 0) {
+    //coordinates of every atom of file, 3 doubles an atom
+    return pdbcoords(file, header, nthreads).coords(nthreads);
+}
+
+static inline void waterwrite(const std::string &file, const std::vector<double> &xyz,
+                              const std::vector<int> *frames = NULL) {
+    /*
+        Writes the waters xyz (9 doubles a water) as a water container, with the frame ids frames if given (one a
+        water). Throws when the file cannot be written.
+    */
+    waterheader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, WATERMAGIC, sizeof(WATERMAGIC));
+    h.version = 1;
+    h.headsize = sizeof(h);
+    h.nwaters = xyz.size()/9;
+    h.flags = frames ? WATERFRAMES : 0;
+    std::vector<float> f(xyz.begin(), xyz.begin() + 9*h.nwaters);
+    std::vector<int32_t> id;
+    if (frames) id.assign(frames->begin(), frames->begin() + h.nwaters);
+    FILE *out = fopen(file.c_str(), "wb");
+    if (out == NULL) throw("cannot write water container");
+    bool ok = fwrite(&h, sizeof(h), 1, out) == 1 && fwrite(f.data(), sizeof(float), f.size(), out) == f.size() &&
+              fwrite(id.data(), sizeof(int32_t), id.size(), out) == id.size();
+    if (fclose(out) != 0 || !ok) throw("cannot write water container");
+}
+
+static inline std::vector<double> pdboxygens(const std::vector<double> &xyz) {
+    //the first atom of every water of xyz (3 atoms, 9 doubles a water)
+    std::vector<double> o(xyz.size()/9*3);
+    for (size_t w = 0; w < o.size()/3; w++) {
+        for (int d = 0; d < 3; d++) o[3*w + d] = xyz[9*w + d];
+    }
+    return o;
+}
+
+#endif /* PDBCOORDS_H */
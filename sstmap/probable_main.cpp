@@ -12,7 +12,17 @@
  */
 
 
-#include "probable.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+#include <math.h>
+#include "kdtree.h"
+#include "waterorient.h"
+#include "pdbcoords.h"
 
 using namespace std;
 
@@ -61,9 +71,6 @@ int main(int argc, char** argv) {
 
 
 
-    vector<double > tmp;
-    double temp;
-    string strtemp;
     /*
     ifstream input(expfile.c_str());
     //getline(input, strtemp); //skip header
@@ -98,233 +105,57 @@ int main(int argc, char** argv) {
     //kdtree trans(tmp2);
     //cout << "made trans tree" << endl;
 
-    vector<double > tmp4;
-    ifstream stput(infile.c_str());
-    //getline(stput, strtemp); //skip header
-    while (!stput.eof()) {
-        getline(stput, strtemp);
-        if (!strtemp.empty()) {
-            temp = atof(strtemp.substr(31, 7).c_str());
-            tmp4.push_back(temp);
-            tmp.push_back(temp);
-            temp = atof(strtemp.substr(39, 7).c_str());
-            tmp4.push_back(temp);
-            tmp.push_back(temp);
-            temp = atof(strtemp.substr(47, 7).c_str());
-            tmp4.push_back(temp);
-            tmp.push_back(temp);
-        }
+    vector<double> tmp4;
+    try {
+        tmp4 = pdbread(infile, false);
     }
-    vector<double > tmp5;
-    for (int i = 0; i < tmp4.size(); i++) {
-        if (i%9 == 0 || i%9 == 1 || i%9 == 2) {
-            tmp5.push_back(tmp4[i]);
-        }
+    catch (const char *err) {
+        cerr << err << ": " << infile << endl;
+        exit(1);
     }
+    const vector<double> &tmp = tmp4;
+    vector<double> tmp5 = pdboxygens(tmp4);
 
-    kdtree trans(tmp5);
+    kdtree<3> trans(tmp5);
     int transi = 0; //index of closest trans
-    int* indt;
-    indt = new int[1];
-    double* distt;
-    distt = new double[1];
+    vector<int> indt(trans.npts);
+    vector<double> distt(trans.npts);
+    trans.all_nearest(1, &indt[0], &distt[0]);
     double winner = 10000.00;
     for (i = 0; i < trans.npts; i++) {
-        trans.nnearest(i, indt, distt, 1);
-        if (distt[0] < winner) {
-            winner = distt[0];
-            transi = indt[0];
+        if (distt[i] < winner) {
+            winner = distt[i];
+            transi = indt[i];
         }
     }
 
-    delete distt;
-    delete indt;
     //s = trans.run_tree_trans(tmp5);
     //transout << s << endl;
     //transout.close();
     /*
         Begin orientational code
     */
-    vector<double > tmp3;
-    double pi = 3.14159265359; double cenndist = 10000;
-    int x_ref[3]; int y_ref[3]; int z_ref[3];
-    x_ref[0] = 1; x_ref[1] = 0; x_ref[2] = 0;
-    y_ref[0] = 0; y_ref[1] = 1; y_ref[2] = 0;
-    z_ref[0] = 0; z_ref[1] = 0; z_ref[2] = 1;
-    double ar[3]; double ar2; double h12; double h22; double h1length; double h2length; double arlength; double dotprohah1; double theta;
-    double crossp_x_ref_h1[3]; double crossp_x_ref_h1_sign; double q[4]; double htemp[3]; double z_mol_vect[3];  double z_mol_vect2;
-    double z_mol_vectlength; double dotproductz_mol_vectz_ref; double theta3p; double crossp_z_mol_vectz_ref[3]; double crossp_z_mol_vectz_ref_sign;
-    double q2[4]; double e[4]; double singtest;
-    for (int i = 0; i < tmp4.size(); i+=9) {
-        tmp4[i+8] -= tmp4[i+2];
-        tmp4[i+5] -= tmp4[i+2];
-        tmp4[i+2] -= tmp4[i+2];
-        tmp4[i+7] -= tmp4[i+1];
-        tmp4[i+4] -= tmp4[i+1];
-        tmp4[i+1] -= tmp4[i+1];
-        tmp4[i+6] -= tmp4[i];
-        tmp4[i+3] -= tmp4[i];
-        tmp4[i] -= tmp4[i];
-        h12 = pow(tmp4[i+3],2) + pow(tmp4[i+4],2) + pow(tmp4[i+5],2);
-        h22 = pow(tmp4[i+6],2) + pow(tmp4[i+7],2) + pow(tmp4[i+8],2);
-        h1length = pow(h12, 0.5);
-        h2length = pow(h22, 0.5);
-        if (tmp4[i+3] != 0) {
-            tmp4[i+3] /= h1length;
-        }
-        if (tmp4[i+4] != 0) {
-            tmp4[i+4] /= h1length;
-        }
-        if (tmp4[i+5] != 0) {
-            tmp4[i+5] /= h1length;
-        }
-        if (tmp4[i+6] != 0) {
-            tmp4[i+6] /= h1length;
-        }
-        if (tmp4[i+7] != 0) {
-            tmp4[i+7] /= h1length;
-        }
-        if (tmp4[i+7] != 0) {
-            tmp4[i+7] /= h1length;
-        }
-        ar[0]=tmp4[i+4]*x_ref[2] - tmp4[i+5]*x_ref[1];
-        ar[1]=tmp4[i+5]*x_ref[0] - tmp4[i+3]*x_ref[2];
-        ar[2]=tmp4[i+3]*x_ref[1] - tmp4[i+4]*x_ref[0];
-        ar2 = pow(ar[0],2) + pow(ar[1],2) + pow(ar[2],2);
-        arlength = pow(ar2, 0.5);
-        if (ar[0] != 0) {
-            ar[0] /= arlength;
-        }
-        if (ar[1] != 0) {
-            ar[1] /= arlength;
-        }
-        if (ar[2] != 0) {
-            ar[2] /= arlength;
-        }
-        dotprohah1 = 0;
-        dotprohah1 += x_ref[0]*tmp4[i+3];
-        dotprohah1 += x_ref[1]*tmp4[i+4];
-        dotprohah1 += x_ref[2]*tmp4[i+5];
-        theta = acos(dotprohah1);
-        crossp_x_ref_h1[0]=tmp4[i+4]*x_ref[2] - tmp4[i+5]*x_ref[1];
-        crossp_x_ref_h1[1]=tmp4[i+5]*x_ref[0] - tmp4[i+3]*x_ref[2];
-        crossp_x_ref_h1[2]=tmp4[i+3]*x_ref[1] - tmp4[i+4]*x_ref[0];
-        crossp_x_ref_h1_sign=crossp_x_ref_h1[0]*tmp4[i+3]+crossp_x_ref_h1[1]*tmp4[i+4]+crossp_x_ref_h1[2]*tmp4[i+5];
-        if (crossp_x_ref_h1_sign > 0) {
-            theta /=2;
-        }
-        else {
-            theta /=-2;
-        }
-        q[0]=cos(theta);
-        q[1]=ar[0]*sin(theta);
-        q[2]=ar[1]*sin(theta);
-        q[3]=ar[2]*sin(theta);
-
-        htemp[0]= ((pow(q[0],2)+pow(q[1],2))-(pow(q[2],2)+pow(q[3],2)))* tmp4[i+3];
-        htemp[0]= (2*(q[1]*q[2] + q[0]*q[3]) * tmp4[i+4] ) + htemp[0];
-        htemp[0]= (2*(q[1]*q[3]-q[0]*q[2])*tmp4[i+5]) + htemp[0];
-        htemp[1]= 2*( q[1]*q[2] - q[0]*q[3] ) * tmp4[i+3];
-        htemp[1]= ( ( q[0]*q[0]-q[1]*q[1]+q[2]*q[2]-q[3]*q[3] ) * tmp4[i+4] ) + htemp[1];
-        htemp[1]= ( 2*( q[2]*q[3] + q[0]*q[1] ) * tmp4[i+5] ) + htemp[1];
-        htemp[2]= 2*( q[1]*q[3] + q[0]*q[2]) * tmp4[i+3];
-        htemp[2]= ( 2*( q[2]*q[3]-q[0]*q[1] ) * tmp4[i+4] ) + htemp[2];
-        htemp[2]=  ( ( q[0]*q[0]-q[1]*q[1]-q[2]*q[2]+q[3]*q[3] ) * tmp4[i+5] ) + htemp[2];
-        tmp4[i+3]=htemp[0];
-        tmp4[i+4]=htemp[1];
-        tmp4[i+5]=htemp[2];
-        htemp[0]= ((pow(q[0],2)+pow(q[1],2))-(pow(q[2],2)+pow(q[3],2)))* tmp4[i+6];
-        htemp[0]= (2*(q[1]*q[2] + q[0]*q[3]) * tmp4[i+7] ) + htemp[0];
-        htemp[0]= (2*(q[1]*q[3]-q[0]*q[2])*tmp4[i+8]) + htemp[0];
-        htemp[1]= 2*( q[1]*q[2] - q[0]*q[3] ) * tmp4[i+6];
-        htemp[1]= ( ( q[0]*q[0]-q[1]*q[1]+q[2]*q[2]-q[3]*q[3] ) * tmp4[i+7] ) + htemp[1];
-        htemp[1]= ( 2*( q[2]*q[3] + q[0]*q[1] ) * tmp4[i+8] ) + htemp[1];
-        htemp[2]= 2*( q[1]*q[3] + q[0]*q[2]) * tmp4[i+6];
-        htemp[2]= ( 2*( q[2]*q[3]-q[0]*q[1] ) * tmp4[i+7] ) + htemp[2];
-        htemp[2]=  ( ( q[0]*q[0]-q[1]*q[1]-q[2]*q[2]+q[3]*q[3] ) * tmp4[i+8] ) + htemp[2];
-        tmp4[i+6]=htemp[0];
-        tmp4[i+7]=htemp[1];
-        tmp4[i+8]=htemp[2];
-        z_mol_vect[0]=tmp4[i+4]*tmp4[i+8] - tmp4[i+5]*tmp4[i+7];
-        z_mol_vect[1]=tmp4[i+5]*tmp4[i+6] - tmp4[i+3]*tmp4[i+8];
-        z_mol_vect[2]=tmp4[i+3]*tmp4[i+7] - tmp4[i+4]*tmp4[i+6];
-        z_mol_vect2= pow(z_mol_vect[0],2) + pow(z_mol_vect[1],2) + pow(z_mol_vect[2],2);
-        z_mol_vectlength=pow(z_mol_vect2,0.5);
-        if (z_mol_vect[0] !=0) {
-            z_mol_vect[0] /= z_mol_vectlength;
-        }
-        if (z_mol_vect[1] !=0) {
-            z_mol_vect[1] /= z_mol_vectlength;
-        }
-        if (z_mol_vect[2] !=0) {
-            z_mol_vect[2] /= z_mol_vectlength;
-        }
-        dotproductz_mol_vectz_ref=0;
-        for(int j=0;j<3;j++) {
-            dotproductz_mol_vectz_ref+=z_mol_vect[j]*z_ref[j];
-        }
-        theta3p= acos(dotproductz_mol_vectz_ref);
-
-        crossp_z_mol_vectz_ref[0]=z_mol_vect[1]*z_ref[2] - z_mol_vect[2]*z_ref[1];
-        crossp_z_mol_vectz_ref[1]=z_mol_vect[2]*z_ref[0] - z_mol_vect[0]*z_ref[2];
-        crossp_z_mol_vectz_ref[2]=z_mol_vect[0]*z_ref[1] - z_mol_vect[1]*z_ref[0];
-
-        crossp_z_mol_vectz_ref_sign=crossp_z_mol_vectz_ref[0]*tmp4[i+3]+crossp_z_mol_vectz_ref[1]*tmp4[i+4]+crossp_z_mol_vectz_ref[2]*tmp4[i+5];
-
-        if (crossp_z_mol_vectz_ref_sign < 0) {
-            theta3p /=2;
-        }
-        else {
-            theta3p /=-2;
-        }
-
-        q2[0]=cos(theta3p);
-        q2[1]=x_ref[0]*sin(theta3p);
-        q2[2]=x_ref[1]*sin(theta3p);
-        q2[3]=x_ref[2]*sin(theta3p);
-
-        e[0]= q[0]*q2[0]  -  q[1]*q2[1]  -  q[2]*q2[2]  -  q[3]*q2[3];
-        e[1]= q[0]*q2[1]  +  q[1]*q2[0]  +  q[2]*q2[3]  -  q[3]*q2[2];
-        e[2]= q[0]*q2[2]  -  q[1]*q2[3]  +  q[2]*q2[0]  +  q[3]*q2[1];
-        e[3]= q[0]*q2[3]  +  q[1]*q2[2]  -  q[2]*q2[1]  +  q[3]*q2[0];
-
-        singtest=((e[1]*e[2]) + (e[3]*e[0]));
-        if (singtest > 0.4999) {
-            tmp3.push_back(sin(pi/2));
-            tmp3.push_back(0);
-            tmp3.push_back(2*atan2(e[1],e[0]));
-        }
-        else if (singtest < -0.4999) {
-            tmp3.push_back(sin(pi/-2));
-            tmp3.push_back(0);
-            tmp3.push_back(-2*atan2(e[1], e[0]));
-        }
-        else {
-            tmp3.push_back(sin(asin(2*singtest)));
-            tmp3.push_back(atan2(((2*e[1]*e[0])-(2*e[2]*e[3])) , (1 - (2*pow(e[1],2)) - (2*pow(e[3],2)))));
-            tmp3.push_back(atan2(((2*e[2]*e[0])-(2*e[1]*e[3])) , (1 - (2*pow(e[2],2)) - (2*pow(e[3],2)))));
-        }
-    }
-    kdtree orient(tmp3);
+    double pi = 3.14159265359;
+    vector<double > tmp3(tmp4.size()/3);
+    if (!tmp3.empty()) waterorient(&tmp4[0], tmp4.size()/9, NULL, &tmp3[0]);
+    kdtree<3> orient(tmp3);
+    orient.setperiod(1, 2*pi); //phi and psi wrap around, sin(theta) does not
+    orient.setperiod(2, 2*pi);
     //s = orient.run_tree_orient();
     //orientout << s << endl;
     //orientout.close();
     int orienti = 0; //index of closest orient
-    int* indo;
-    indo = new int[1];
-    double* disto;
-    disto = new double[1];
+    vector<int> indo(orient.npts);
+    vector<double> disto(orient.npts);
+    orient.all_nearest(1, &indo[0], &disto[0]);
     winner = 10000.00;
     for (i = 0; i < orient.npts; i++) {
-        orient.nnearest(i, indo, disto, 1);
-        if (disto[0] < winner) {
-            winner = disto[0];
-            orienti = indo[0];
+        if (disto[i] < winner) {
+            winner = disto[i];
+            orienti = indo[i];
         }
     }
 
-    delete disto;
-    delete indo;
 
     /*
         Determined the best water orientation as orienti in array of pts
@@ -359,9 +190,9 @@ int main(int argc, char** argv) {
     //fprintf (tFile, "%-6s%5i %-4s %3s %1s%4i    %8.3f%8.3f%8.3f%6.2f%6.2f\n", name.c_str(), i, "H", resname.c_str(), chainid.c_str(), resseq, orientH2_x, orientH2_y, orientH2_z, 0.0, 0.0);
 
 
-    double transO_x = trans.pts[transi].x[0];
-    double transO_y = trans.pts[transi].x[1];
-    double transO_z = trans.pts[transi].x[2];
+    double transO_x = trans.coordinate(transi, 0);
+    double transO_y = trans.coordinate(transi, 1);
+    double transO_z = trans.coordinate(transi, 2);
 
     double distx = (transO_x - orientO_x);
     double disty = (transO_y - orientO_y);
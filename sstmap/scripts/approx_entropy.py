@@ -0,0 +1,93 @@
+from argparse import ArgumentParser
+import glob
+import math
+import os
+import sys
+import time
+
+import _sstmap_entropy as ext1
+
+
+def parse_args():
+    """Parse the command-line arguments and check if input args are valid.
+
+    Returns
+    -------
+    args : argparse.Namespace
+        The namespace containing the arguments
+    """
+    parser = ArgumentParser(
+        description='''Compare approximate nearest neighbour entropies with the exact ones on the cluster files of a
+        site-based calculation, reporting the change in entropy against the speedup.''')
+    parser.add_argument('-s', '--cluster_dir', required=False, type=str, default=".",
+                        help='''Directory holding the cluster.NNNNNN.wat (or .pdb) files of the hydration sites.''')
+    parser.add_argument('-e', '--expanded_dir', required=False, type=str, default="entropy_output",
+                        help='''Directory holding the expanded cluster files, entropy_output/ of a site-based
+                        calculation run with export_clusters (run_hsa -x).''')
+    parser.add_argument('-a', '--eps', required=False, type=float, nargs='+', default=[0.01, 0.05, 0.1],
+                        help='''Approximation factors to try, distances are within 1 + eps of the exact ones.''')
+    parser.add_argument('-r', '--repeats', required=False, type=int, default=3,
+                        help='''Number of timed runs per site, the fastest one is kept.''')
+
+    args = parser.parse_args()
+    if not os.path.isdir(args.cluster_dir):
+        sys.exit("%s not found. Please make sure it exits or give the correct path." % args.cluster_dir)
+    if not os.path.isdir(args.expanded_dir):
+        sys.exit("%s not found. Please make sure it exits or give the correct path." % args.expanded_dir)
+    return args
+
+
+def site_entropies(cluster_file, expanded_file, eps, repeats):
+    """Run the entropy calculation of one site, nothing is written.
+
+    Returns
+    -------
+    trans, orient, seconds : float
+        Translational and orientational entropies, and the best time of the runs
+    """
+    best = None
+    for i in range(repeats):
+        start = time.time()
+        trans, orient = ext1.run_kdhsa102(cluster_file, expanded_file, eps=eps, append=0)
+        elapsed = time.time() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return trans, orient, best
+
+
+def main():
+    args = parse_args()
+    sites = []
+    cluster_files = glob.glob(os.path.join(args.cluster_dir, "cluster.[0-9]*.wat"))
+    cluster_files += glob.glob(os.path.join(args.cluster_dir, "cluster.[0-9]*.pdb"))
+    for cluster_file in sorted(cluster_files):
+        expanded_file = os.path.join(args.expanded_dir, os.path.basename(cluster_file))
+        if os.path.isfile(expanded_file):
+            sites.append((os.path.abspath(cluster_file), os.path.abspath(expanded_file)))
+    if not sites:
+        sys.exit("No cluster files with an expanded counterpart found.")
+
+    exact = [site_entropies(c, e, 0.0, args.repeats) for c, e in sites]
+    # sites with too few waters for an estimate come back as NaN and are left out
+    kept = [i for i, (s_t, s_o, t) in enumerate(exact) if not (math.isnan(s_t) or math.isnan(s_o))]
+    sites, exact = [sites[i] for i in kept], [exact[i] for i in kept]
+    if not sites:
+        sys.exit("No site has enough waters for an entropy estimate.")
+    exact_time = sum(t for s_t, s_o, t in exact)
+    print("%d sites, exact run %.3f s" % (len(sites), exact_time))
+    print("%6s %9s %8s %16s %16s %16s %16s" % ("eps", "time (s)", "speedup", "mean |dS_trans|", "max |dS_trans|",
+                                              "mean |dS_orient|", "max |dS_orient|"))
+    for eps in args.eps:
+        approx = [site_entropies(c, e, eps, args.repeats) for c, e in sites]
+        approx_time = sum(t for s_t, s_o, t in approx)
+        d_trans = [abs(a[0] - x[0]) for a, x in zip(approx, exact)]
+        d_orient = [abs(a[1] - x[1]) for a, x in zip(approx, exact)]
+        print("%6.3f %9.3f %8.2f %16.3e %16.3e %16.3e %16.3e" % (eps, approx_time, exact_time / approx_time,
+                                                            sum(d_trans) / len(sites), max(d_trans),
+                                                            sum(d_orient) / len(sites), max(d_orient)))
+
+
+def entry_point():
+    main()
+
+if __name__ == '__main__':
+    entry_point()
@@ -37,6 +37,9 @@ def parse_args():
                         help='''Bulk density of the water model.''')
     parser.add_argument('-o', '--output_prefix', required=False, type=str, default="hsa",
                         help='''Prefix for all the results files.''')
+    parser.add_argument('-x', '--export_clusters', action='store_true',
+                        help='''Also write the waters of the HSA region, of each hydration site and of its
+                        expanded cluster to water container files.''')
 
     if len(sys.argv[1:]) == 0:
         parser.print_help()
@@ -84,7 +87,7 @@ def main():
                         clustercenter_file=clusters, rho_bulk=args.bulk_density, prefix=args.output_prefix)
     h.initialize_hydration_sites()
     h.print_system_summary()
-    h.calculate_site_quantities()
+    h.calculate_site_quantities(export_clusters=args.export_clusters)
     h.write_calculation_summary()
     h.write_data()
     os.chdir(curr_dir)
@@ -36,6 +36,8 @@ MD trajectories.
 
 import subprocess
 import shutil, sys
+import warnings
+import multiprocessing
 import numpy as np
 from scipy import spatial
 import mdtraj as md
@@ -122,6 +124,8 @@ class SiteWaterAnalysis(WaterAnalysis):
         self.hsa_region_O_ids = []
         self.hsa_region_flat_ids = []
         self.hsa_region_water_coords = None
+        self.site_entropy_seconds = None
+        self.site_water_frames = None
         self.data_titles = ["index", "x", "y", "z",
                             "nwat", "occupancy",
                             "Esw", "EswLJ", "EswElec",
@@ -477,7 +481,8 @@ class SiteWaterAnalysis(WaterAnalysis):
         hbonds : bool
             Flag for hydrogen bond calculations
         entropy :bool
-            Flag for entropy calculations
+            Flag for entropy calculations, the coordinates of the hydration site region waters are only stored
+            when set
 
         Returns
         -------
@@ -505,6 +510,7 @@ class SiteWaterAnalysis(WaterAnalysis):
                         for index_pair in index_pairs:
                             self.hsa_dict[site_i][-1][index_pair[1]] += coords[0, index_pair[0], :]
                         self.hsa_data[site_i, 4] += 1
+                        self.site_water_frames[site_i].append(frame_i - self.start_frame)
 
             if wat_O is not None and (energy or hbonds):
                 distance_matrix = np.zeros((self.water_sites, self.all_atom_ids.shape[0]), np.float_)
@@ -606,7 +612,7 @@ class SiteWaterAnalysis(WaterAnalysis):
     @function_timer
     def calculate_site_quantities(self, energy=True, entropy=True, hbonds=True,
                                         energy_lr_breakdown=False, angular_structure=False,
-                                        shell_radii=None, r_theta_cutoff=6.0):
+                                        shell_radii=None, r_theta_cutoff=6.0, export_clusters=False):
         """
         Performs site-based solvation thermodynamics and structure calculations by iterating
         over frames in the trajectory. If water molecules in hydration sites are already determined
@@ -624,6 +630,9 @@ class SiteWaterAnalysis(WaterAnalysis):
             Description
         entropy : bool, optional
             Description
+        export_clusters : bool, optional
+            Also write the hydration site region and hydration site waters to water containers, see
+            generate_data_for_entropycalcs. The entropies are computed in memory and do not need them.
 
         Returns
         -------
@@ -650,6 +659,7 @@ class SiteWaterAnalysis(WaterAnalysis):
                       "Resetting angular structure distance cutoff to 8.0 Angstrom")
                 r_theta_cutoff = 8.0
             self.angular_st_distribution = [[] for i in range(self.hsa_data.shape[0])]
+        self.site_water_frames = [[] for i in range(self.hsa_data.shape[0])]
 
         with md.open(self.trajectory) as f:
             for frame_i in range(self.start_frame, self.start_frame + self.num_frames):
@@ -664,7 +674,8 @@ class SiteWaterAnalysis(WaterAnalysis):
                     print("No more frames to read.")
                     break
                 else:
-                    self._process_frame(trj, frame_i, energy, hbonds, entropy,
+                    # the exported containers need the region waters as much as the entropies do
+                    self._process_frame(trj, frame_i, energy, hbonds, entropy or export_clusters,
                                         energy_lr_breakdown, angular_structure,
                                         shell_radii, r_theta_cutoff)
                     read_num_frames += 1
@@ -672,99 +683,158 @@ class SiteWaterAnalysis(WaterAnalysis):
                 print(("{0:d} frames found in the trajectory, resetting self.num_frames.".format(read_num_frames)))
                 self.num_frames = read_num_frames
 
-        if entropy:
+        if export_clusters:
             self.generate_data_for_entropycalcs(self.start_frame, self.num_frames)
+        if entropy:
             self.run_entropy_scripts()
         self.normalize_site_quantities(self.num_frames)
 
 
 
     @function_timer
-    def generate_data_for_entropycalcs(self, start_frame, num_frames, user_defined_clusters=False):
-        """
+    def generate_data_for_entropycalcs(self, start_frame, num_frames, user_defined_clusters=False, pdb=False):
+        """Writes the hydration site region waters to within5Aofligand.wat, the waters of each hydration site to
+        cluster.NNNNNN.wat and its expanded cluster, the region waters within 2 A of the site center, to
+        entropy_output/cluster.NNNNNN.wat. These are binary water containers (see utils.write_water_container) that
+        also hold the frame of every water. The entropy and clustering extensions take them wherever they take a PDB
+        file, scripts/approx_entropy.py runs on them; the entropies of calculate_site_quantities are computed in
+        memory and do not need them.
+
+        Parameters
+        ----------
+        pdb : bool, optional
+            Also export the same waters as within5Aofligand.pdb and cluster.NNNNNN.pdb text files.
         """
-        print("Writing PDB file containing all HSA region water molecules for entropy calculations.")
-        write_watpdb_from_coords("within5Aofligand", self.hsa_region_water_coords, full_water_res=True)
-        print("Done.")
-        print("Writing PDB files for all water molecules in each hydration site.")
+        print("Writing water containers for the hydration site region and each hydration site.")
+        write_water_container("within5Aofligand.wat", self.hsa_region_water_coords, self._region_water_frames())
+        if pdb:
+            write_watpdb_from_coords("within5Aofligand", self.hsa_region_water_coords, full_water_res=True)
         for site_i in range(self.hsa_data.shape[0]):
             # print site_i, len(self.hsa_dict[site_i][-1])/3.0, self.hsa_data[site_i, 4]
             num_wat = int(self.hsa_data[site_i, 4]) * 3
             # print num_wat, self.hsa_dict[site_i][-1].shape
             cluster_name = '{0:06d}'.format(site_i + 1)
-            write_watpdb_from_coords("cluster." + cluster_name, self.hsa_dict[site_i][-1][:num_wat, :],
-                                     full_water_res=True)
+            frames = None
+            if self.site_water_frames is not None:
+                frames = np.asarray(self.site_water_frames[site_i], dtype=int)[:num_wat // 3]
+            write_water_container("cluster." + cluster_name + ".wat", self.hsa_dict[site_i][-1][:num_wat, :], frames)
+            if pdb:
+                write_watpdb_from_coords("cluster." + cluster_name, self.hsa_dict[site_i][-1][:num_wat, :],
+                                         full_water_res=True)
+        # the expanded clusters are those of run_entropy_scripts, as bruteclust used to write them
+        std_waters, std_offsets, exp_waters, exp_offsets, exp_ids = self._site_entropy_waters()
+        exp_frames = self._region_water_frames()[exp_ids]
+        if not os.path.exists("entropy_output"):
+            os.makedirs("entropy_output")
+        for site_i in range(self.hsa_data.shape[0]):
+            cluster_name = os.path.join("entropy_output", 'cluster.{0:06d}'.format(site_i + 1))
+            site = slice(exp_offsets[site_i], exp_offsets[site_i + 1])
+            write_water_container(cluster_name + ".wat", exp_waters[site], exp_frames[site])
+            if pdb:
+                write_watpdb_from_coords(cluster_name, exp_waters[site].reshape(-1, 3), full_water_res=True)
         print("Done.")
 
+    def _region_water_frames(self):
+        """Frame of every hydration site region water, counted from the first frame analysed."""
+        # the region waters are stored frame after frame, three rows each
+        region_frames = np.zeros(self.hsa_region_water_coords.shape[0] // 3, dtype=int)
+        for frame_i, flat_ids in enumerate(self.hsa_region_flat_ids):
+            region_frames[np.asarray(flat_ids, dtype=int) // 3] = frame_i
+        return region_frames
+
+    def _site_entropy_waters(self):
+        """Waters of the standard and expanded clusters of all sites, laid out for the entropy extension: the waters
+        of site i are rows offsets[i]:offsets[i + 1] of the N x 3 x 3 water arrays. Also returns, for every expanded
+        cluster water, its index among the hydration site region waters.
+        """
+        # the entropy code is handed the waters directly, rounded to the three decimals of the cluster files so that
+        # the results are those of the file based calculation
+        region_waters = np.round(self.hsa_region_water_coords, 3).reshape(-1, 3, 3)
+        site_centers = np.round(self.hsa_data[:, 1:4], 3)
+        n_sites = self.hsa_data.shape[0]
+        # expanded clusters, all waters with the oxygen within 2 A of the site center, in region order; the search
+        # radius is a hair wider so that the test on the squared distance alone decides
+        print("Generating expanded cluster waters...")
+        oxygen_tree = spatial.cKDTree(region_waters[:, 0, :])
+        expanded_ids = []
+        for center, nbrs in zip(site_centers, oxygen_tree.query_ball_point(site_centers, 2.0 * (1 + 1e-9))):
+            nbrs = np.sort(np.asarray(nbrs, dtype=int))
+            d = region_waters[nbrs, 0, :] - center
+            expanded_ids.append(nbrs[d[:, 0]**2 + d[:, 1]**2 + d[:, 2]**2 <= 4.0])
+        std_waters = [np.round(self.hsa_dict[site_i][-1][:int(self.hsa_data[site_i, 4]) * 3, :], 3).reshape(-1, 3, 3)
+                      for site_i in range(n_sites)]
+        std_offsets = np.concatenate(([0], np.cumsum([w.shape[0] for w in std_waters]))).astype(int)
+        exp_offsets = np.concatenate(([0], np.cumsum([ids.shape[0] for ids in expanded_ids]))).astype(int)
+        std_waters = np.concatenate(std_waters + [np.zeros((0, 3, 3))])
+        exp_ids = np.concatenate(expanded_ids + [np.zeros(0, dtype=int)])
+        return std_waters, std_offsets, region_waters[exp_ids], exp_offsets, exp_ids
+
     @function_timer
-    def run_entropy_scripts(self, output_dir=None):
-        """Rerurns list of trans and orient entropies for each cluster.
+    def run_entropy_scripts(self, output_dir=None, n_threads=None):
+        """Calculates trans and orient entropies and the most probable configuration of each cluster, adds the
+        entropies to the summary data and writes the configurations to probable_configs.pdb.
 
         Parameters
         ----------
         output_dir: string
-            Name of the output directory
+            Deprecated and ignored, nothing is written but probable_configs.pdb. Passing it warns.
+        n_threads: int
+            Number of threads the sites are spread over. Defaults to the number of CPUs.
         """
-        # run bruteclust in a newly created output directory
-        curr_dir = os.getcwd()
         if output_dir is not None:
-            if not os.path.exists(output_dir):
-                os.makedirs(output_dir)
-            else:
-                shutil.rmtree(output_dir)
-                os.makedirs(output_dir)
+            warnings.warn("run_entropy_scripts no longer writes to output_dir, the argument is ignored",
+                          DeprecationWarning, stacklevel=2)
+        std_waters, std_offsets, exp_waters, exp_offsets, exp_ids = self._site_entropy_waters()
 
-        else:
-            output_dir = "entropy_output"
-            if not os.path.exists(output_dir):
-                os.makedirs(output_dir)
-            else:
-                shutil.rmtree(output_dir)
-                os.makedirs(output_dir)
-
-        # prepare arguments for bruteclust, which are file paths
-        input_c_arg = os.path.abspath(self.clustercenter_file)
-        input_w_arg = os.path.abspath("within5Aofligand.pdb")
-        # run bruteclust inside the output directory
-        os.chdir(curr_dir + "/" + output_dir)
-        print("Generating expanded cluster water files...")
-        try:
-            # subprocess.check_call("bruteclust  -c " + input_c_arg + " -w " + input_w_arg, shell=True)
-            ext1.run_bruteclust(input_c_arg, input_w_arg)
-        except Exception as e:
-            print(e)
-        os.chdir(curr_dir)
-        # run entropy code, make sure previous output files do not exist
-        trans_dat, orient_dat = os.path.abspath("trans.dat"), os.path.abspath("orient.dat")
-        if os.path.isfile(trans_dat):
-            os.remove(trans_dat)
-        if os.path.isfile(orient_dat):
-            os.remove(orient_dat)
-
-        # run entropy code and generate most probable config
-        input_o_arg = os.path.abspath(output_dir + "/probable.pdb")
         print("Running entropy calculation from extension module.")
-        for site_i in range(self.hsa_data.shape[0]):
-            cluster_filename = "cluster.{0:06d}.pdb".format(site_i + 1)
-            input_i_arg = os.path.abspath(cluster_filename)
-            input_e_arg = os.path.abspath(output_dir + "/" + cluster_filename)
-            try:
-                ext1.run_kdhsa102(input_i_arg, input_e_arg)
-                ext2.run_probconfig(input_i_arg, input_o_arg)
-            except Exception as e:
-                print(e)
-
-        a = np.loadtxt(input_o_arg, usecols=(6, 7, 8))
-        write_watpdb_from_coords("probable_configs", a, full_water_res=True)
-        # extract entropy data and put into summary data
-        if os.path.isfile(trans_dat) and os.path.isfile(orient_dat):
-            trans_ent, orient_ent = np.loadtxt(trans_dat), np.loadtxt(orient_dat)
-            if trans_ent.shape[0] == self.hsa_data.shape[0] and orient_ent.shape[0] == self.hsa_data.shape[0]:
-                self.hsa_data[:, 14] += trans_ent
-                self.hsa_data[:, 15] += orient_ent
-                self.hsa_data[:, 16] += trans_ent + orient_ent
-        shutil.rmtree(output_dir)
-        os.remove(input_w_arg)
+        if n_threads is None:
+            n_threads = multiprocessing.cpu_count()
+        trans_ent, orient_ent, probable, seconds = ext1.run_site_entropies(std_waters, std_offsets, exp_waters,
+                                                                           exp_offsets, n_threads=n_threads)
+        slowest = np.argsort(seconds)[::-1][:5]
+        print("Slowest sites (index, waters, seconds): " +
+              ", ".join("({0:d}, {1:d}, {2:.3f})".format(site_i, std_offsets[site_i + 1] - std_offsets[site_i],
+                                                         seconds[site_i]) for site_i in slowest))
+        self.site_entropy_seconds = seconds
+
+        # sites without waters come back as NaN and are left out
+        done = ~np.isnan(trans_ent)
+        write_watpdb_from_coords("probable_configs", probable[done].reshape(-1, 3), full_water_res=True)
+        self.hsa_data[done, 14] += trans_ent[done]
+        self.hsa_data[done, 15] += orient_ent[done]
+        self.hsa_data[done, 16] += trans_ent[done] + orient_ent[done]
+
+    @function_timer
+    def calculate_entropy_convergence(self, n_blocks=10, n_threads=None):
+        """Calculates the trans and orient entropies of each cluster over windows of the trajectory, to judge their
+        convergence: for each of n_blocks consecutive blocks of frames on its own and for the growing prefixes of
+        the trajectory, blocks 0..j. All windows come from a single pass of the entropy extension, at less than
+        twice the cost of run_entropy_scripts for ten blocks. Requires calculate_site_quantities to have been run
+        with entropy=True.
+
+        Parameters
+        ----------
+        n_blocks : int
+            Number of blocks the frames are split into, 10 gives the entropies of every tenth of the trajectory and
+            of the first 10%, 20%, ... of it.
+        n_threads: int
+            Number of threads the sites are spread over. Defaults to the number of CPUs.
+
+        Returns
+        -------
+        block_trans, block_orient, prefix_trans, prefix_orient : np.ndarray, float, shape(N_sites, n_blocks)
+            Entropies of the blocks and of the prefixes, the last prefix being the whole trajectory. A window a site
+            has no waters in is NaN. In each window the density of the translational estimate is scaled to its
+            share of the frames.
+        """
+        std_waters, std_offsets, exp_waters, exp_offsets, exp_ids = self._site_entropy_waters()
+        std_frames = np.concatenate([np.asarray(frames, dtype=int)[:int(self.hsa_data[site_i, 4])]
+                                     for site_i, frames in enumerate(self.site_water_frames)] + [np.zeros(0, int)])
+        region_frames = self._region_water_frames()
+        if n_threads is None:
+            n_threads = multiprocessing.cpu_count()
+        return ext1.run_site_convergence(std_waters, std_frames, std_offsets, exp_waters, region_frames[exp_ids],
+                                         exp_offsets, self.num_frames, n_blocks=n_blocks, n_threads=n_threads)
 
     @function_timer
     def normalize_site_quantities(self, num_frames):
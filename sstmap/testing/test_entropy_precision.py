@@ -0,0 +1,92 @@
+"""
+Test that the single precision k-d trees of the entropy extension give the same site entropies as the double
+precision ones, to the six decimals the hydration site summary prints them with.
+
+A synthetic site is written in the layout the entropy code reads, a standard cluster file (waters within 1 A of
+the site center, with a header line) and an expanded cluster file (waters within 2 A, no header), and both
+entropies are computed in each precision.
+"""
+
+
+import os
+import shutil
+import tempfile
+
+import numpy as np
+import numpy.testing as npt
+
+import _sstmap_entropy as ext1
+
+PDB_LINE = "%-6s%5i %-4s %3s %1s%4i    %8.3f%8.3f%8.3f%6.2f%6.2f\n"
+
+
+def write_waters(filename, waters, header=False):
+    """Write waters (n x 3 x 3 array of O, H1, H2 positions) in the fixed columns of the cluster files."""
+    with open(filename, "w") as f:
+        if header:
+            f.write("REMARK\n")
+        for i, water in enumerate(waters):
+            for j, atom in enumerate(["O", "H", "H"]):
+                f.write(PDB_LINE % ("ATOM", 3*i + j, atom, "T3P", "C", 1, water[j][0], water[j][1], water[j][2], 0.0, 0.0))
+
+
+def synthetic_site(center, n_wat, seed=1):
+    """Waters with random orientations, their oxygens uniform in a 2 A sphere around center."""
+    rng = np.random.RandomState(seed)
+    oxygens = []
+    while len(oxygens) < n_wat:
+        p = rng.uniform(-2.0, 2.0, 3)
+        if np.dot(p, p) <= 4.0:
+            oxygens.append(center + p)
+    waters = []
+    half_angle = np.radians(104.52)/2
+    for o in oxygens:
+        q = rng.normal(size=4)
+        q /= np.linalg.norm(q)
+        w, x, y, z = q
+        rot = np.array([[1 - 2*(y*y + z*z), 2*(x*y - w*z), 2*(x*z + w*y)],
+                        [2*(x*y + w*z), 1 - 2*(x*x + z*z), 2*(y*z - w*x)],
+                        [2*(x*z - w*y), 2*(y*z + w*x), 1 - 2*(x*x + y*y)]])
+        h1 = 0.9572*np.array([np.sin(half_angle), np.cos(half_angle), 0.0])
+        h2 = 0.9572*np.array([-np.sin(half_angle), np.cos(half_angle), 0.0])
+        waters.append([o, o + rot.dot(h1), o + rot.dot(h2)])
+    return np.round(np.array(waters), 3)
+
+
+def site_entropies(std_file, exp_file, single):
+    """Translational and orientational entropies of one site, run in a scratch directory."""
+    curr_dir = os.getcwd()
+    work_dir = tempfile.mkdtemp()
+    try:
+        os.chdir(work_dir)
+        ext1.run_kdhsa102(std_file, exp_file, "", 0.0, single)
+        trans = float(open("trans.dat").read().split()[-1])
+        orient = float(open("orient.dat").read().split()[-1])
+    finally:
+        os.chdir(curr_dir)
+        shutil.rmtree(work_dir)
+    return trans, orient
+
+
+def test_single_precision_entropy():
+    data_dir = tempfile.mkdtemp()
+    try:
+        # far from the origin of the system, as sites usually are
+        center = np.array([41.372, -27.915, 63.208])
+        waters = synthetic_site(center, 4000)
+        dist = np.sqrt(((waters[:, 0, :] - center)**2).sum(axis=1))
+        std_file = os.path.join(data_dir, "cluster.000001.pdb")
+        exp_file = os.path.join(data_dir, "expanded.000001.pdb")
+        write_waters(std_file, waters[dist <= 1.0], header=True)
+        write_waters(exp_file, waters)
+
+        double_trans, double_orient = site_entropies(std_file, exp_file, 0)
+        single_trans, single_orient = site_entropies(std_file, exp_file, 1)
+        npt.assert_almost_equal(single_trans, double_trans, decimal=6)
+        npt.assert_almost_equal(single_orient, double_orient, decimal=6)
+    finally:
+        shutil.rmtree(data_dir)
+
+
+if __name__ == '__main__':
+    test_single_precision_entropy()
@@ -0,0 +1,323 @@
+"""
+Test that the entropies computed from water coordinate arrays are those computed from the cluster files holding
+the same waters.
+"""
+
+
+import os
+import shutil
+import tempfile
+
+import mdtraj as md
+import numpy as np
+import numpy.testing as npt
+
+import _sstmap_entropy as ext1
+from sstmap.site_water_analysis import SiteWaterAnalysis
+from sstmap.testing.test_entropy_precision import write_waters, synthetic_site
+from sstmap.utils import write_water_container, read_water_container, write_watpdb_from_coords
+
+
+def test_site_entropy_arrays():
+    data_dir = tempfile.mkdtemp()
+    try:
+        center = np.array([41.372, -27.915, 63.208])
+        waters = synthetic_site(center, 2000, seed=2)
+        dist = np.sqrt(((waters[:, 0, :] - center)**2).sum(axis=1))
+        std_file = os.path.join(data_dir, "cluster.000001.pdb")
+        exp_file = os.path.join(data_dir, "expanded.000001.pdb")
+        write_waters(std_file, waters[dist <= 1.0], header=True)
+        write_waters(exp_file, waters)
+
+        for single in [0, 1]:
+            file_trans, file_orient = ext1.run_kdhsa102(std_file, exp_file, single=single, kmax=3, append=0)
+            trans, orient = ext1.run_site_entropy(waters[dist <= 1.0], waters, single=single, kmax=3)
+            npt.assert_almost_equal(trans, file_trans, decimal=10)
+            npt.assert_almost_equal(orient, file_orient, decimal=10)
+        # float32 input is converted, wrongly shaped input is refused
+        trans, orient = ext1.run_site_entropy(waters[dist <= 1.0].astype(np.float32), waters)
+        npt.assert_raises(ValueError, ext1.run_site_entropy, waters[:, :, :2], waters)
+    finally:
+        shutil.rmtree(data_dir)
+
+
+def test_site_entropy_pdb_records():
+    data_dir = tempfile.mkdtemp()
+    try:
+        center = np.array([41.372, -27.915, 63.208])
+        waters = synthetic_site(center, 1000, seed=5)
+        dist = np.sqrt(((waters[:, 0, :] - center)**2).sum(axis=1))
+        std_file = os.path.join(data_dir, "cluster.000001.pdb")
+        exp_file = os.path.join(data_dir, "expanded.000001.pdb")
+        write_waters(std_file, waters[dist <= 1.0], header=True)
+        write_waters(exp_file, waters)
+        # TER and END records are skipped and the last line needs no newline
+        with open(std_file, "a") as f:
+            f.write("TER\n\nEND")
+        with open(exp_file) as f:
+            lines = f.read().rstrip("\n")
+        with open(exp_file, "w") as f:
+            f.write(lines)
+        file_trans, file_orient = ext1.run_kdhsa102(std_file, exp_file, single=0, append=0)
+        trans, orient = ext1.run_site_entropy(waters[dist <= 1.0], waters, single=0)
+        npt.assert_almost_equal(trans, file_trans, decimal=10)
+        npt.assert_almost_equal(orient, file_orient, decimal=10)
+        npt.assert_raises(RuntimeError, ext1.run_kdhsa102, os.path.join(data_dir, "missing.pdb"), exp_file, append=0)
+    finally:
+        shutil.rmtree(data_dir)
+
+
+def test_water_container():
+    data_dir = tempfile.mkdtemp()
+    curr_dir = os.getcwd()
+    try:
+        center = np.array([41.372, -27.915, 63.208])
+        waters = synthetic_site(center, 1500, seed=9)
+        frames = np.arange(waters.shape[0]) // 10
+        waters32 = waters.astype(np.float32).astype(float)
+        dist2 = ((waters32[:, 0, :] - center)**2).sum(axis=1)
+        std_file = os.path.join(data_dir, "standard.wat")
+        exp_file = os.path.join(data_dir, "expanded.wat")
+        write_water_container(std_file, waters[dist2 <= 1.0], frames[dist2 <= 1.0])
+        write_water_container(exp_file, waters, frames)
+        read_waters, read_frames = read_water_container(exp_file)
+        npt.assert_equal(read_waters, waters.astype(np.float32))
+        npt.assert_equal(read_frames, frames)
+
+        # the entropy entry points take the container wherever they take a PDB file
+        for single in [0, 1]:
+            file_trans, file_orient = ext1.run_kdhsa102(std_file, exp_file, single=single, append=0)
+            trans, orient = ext1.run_site_entropy(waters32[dist2 <= 1.0], waters32, single=single)
+            npt.assert_almost_equal(trans, file_trans, decimal=10)
+            npt.assert_almost_equal(orient, file_orient, decimal=10)
+
+        # given a container bruteclust writes its clusters as containers too, with the frames of their waters
+        write_watpdb_from_coords(os.path.join(data_dir, "centers"), center[np.newaxis, :])
+        os.chdir(data_dir)
+        ext1.run_bruteclust(os.path.join(data_dir, "centers.pdb"), exp_file)
+        near_waters, near_frames = read_water_container(os.path.join(data_dir, "cluster.000001.wat"))
+        npt.assert_equal(near_waters, waters.astype(np.float32)[dist2 <= 4.0])
+        npt.assert_equal(near_frames, frames[dist2 <= 4.0])
+
+        # a container cut short is refused
+        with open(exp_file, "rb") as f:
+            data = f.read()
+        with open(exp_file, "wb") as f:
+            f.write(data[:-4])
+        npt.assert_raises(RuntimeError, ext1.run_kdhsa102, std_file, exp_file, append=0)
+        npt.assert_raises(ValueError, read_water_container, exp_file)
+        # waters that are not O, H1, H2 triples and a frame count other than the number of waters are refused
+        npt.assert_raises(ValueError, write_water_container, exp_file, waters[:, :, :2])
+        npt.assert_raises(ValueError, write_water_container, exp_file, waters.reshape(-1, 9))
+        npt.assert_raises(ValueError, write_water_container, exp_file, waters, frames[:-1])
+    finally:
+        os.chdir(curr_dir)
+        shutil.rmtree(data_dir)
+
+
+def small_site_analysis(data_dir):
+    """A SiteWaterAnalysis over a two frame trajectory of three waters written to data_dir, with one hydration site
+    that holds water 0 in frame 0 and water 1 in frame 1; all three waters are in the hydration site region in frame
+    0, the first two in frame 1. Returns the analysis and the coordinates of the trajectory in angstrom.
+    """
+    top = md.Topology()
+    chain = top.add_chain()
+    for i in range(3):
+        res = top.add_residue("HOH", chain)
+        oxygen = top.add_atom("O", md.element.oxygen, res)
+        for name in ["H1", "H2"]:
+            top.add_bond(oxygen, top.add_atom(name, md.element.hydrogen, res))
+    xyz = np.random.RandomState(4).uniform(1.0, 2.0, size=(2, 9, 3)).astype(np.float32)
+    trj = md.Trajectory(xyz, top, unitcell_lengths=np.full((2, 3), 3.0), unitcell_angles=np.full((2, 3), 90.0))
+    trj[0].save_pdb(os.path.join(data_dir, "top.pdb"))
+    trj.save_dcd(os.path.join(data_dir, "traj.dcd"))
+
+    # the state initialize_hydration_sites leaves behind, without the clustering
+    h = SiteWaterAnalysis.__new__(SiteWaterAnalysis)
+    h.topology_file = os.path.join(data_dir, "top.pdb")
+    h.trajectory = os.path.join(data_dir, "traj.dcd")
+    h.start_frame, h.num_frames, h.water_sites, h.rho_bulk = 0, 2, 3, 0.0334
+    h.data_titles = ["index", "x", "y", "z", "nwat", "occupancy", "Esw", "EswLJ", "EswElec", "Eww", "EwwLJ",
+                     "EwwElec", "Etot", "Ewwnbr", "TSsw_trans", "TSsw_orient", "TStot", "Nnbrs", "Nhbww", "Nhbsw",
+                     "Nhbtot", "f_hb_ww", "f_enc", "Acc_ww", "Don_ww", "Acc_sw", "Don_sw", "solute_acceptors",
+                     "solute_donors"]
+    h.hsa_data, h.hsa_dict = h.initialize_site_data(10.0 * xyz[0, 0:1, :].astype(float))
+    h.site_waters = [[(0, 0), (1, 3)]]
+    h.is_site_waters_populated = True
+    h.hsa_region_O_ids = [[0, 3, 6], [0, 3]]
+    h.hsa_region_flat_ids = [[0, 3, 6], [9, 12]]
+    h.hsa_region_water_coords = np.zeros((15, 3))
+    h.site_water_frames = None
+    h.energy_ww_lr_breakdown = None
+    h.angular_st_distribution = None
+    return h, 10.0 * xyz.reshape(2, 3, 3, 3)
+
+
+def test_export_clusters():
+    data_dir = tempfile.mkdtemp()
+    curr_dir = os.getcwd()
+    try:
+        h, waters = small_site_analysis(data_dir)
+        os.chdir(data_dir)
+        # the region waters are stored for the export even when no entropy is asked for
+        h.calculate_site_quantities(energy=False, entropy=False, hbonds=False, export_clusters=True)
+        region_waters, region_frames = read_water_container("within5Aofligand.wat")
+        npt.assert_allclose(region_waters, np.concatenate((waters[0], waters[1, :2])), atol=1e-4)
+        npt.assert_equal(region_frames, [0, 0, 0, 1, 1])
+        site_waters, site_frames = read_water_container("cluster.000001.wat")
+        npt.assert_allclose(site_waters, [waters[0, 0], waters[1, 1]], atol=1e-4)
+        npt.assert_equal(site_frames, [0, 1])
+        # the expanded cluster holds the region waters within 2 A of the site center, rounded as the entropies see
+        # them
+        region = np.round(np.concatenate((waters[0], waters[1, :2])), 3)
+        near = ((region[:, 0, :] - np.round(h.hsa_data[0, 1:4], 3))**2).sum(axis=1) <= 4.0
+        exp_waters, exp_frames = read_water_container(os.path.join("entropy_output", "cluster.000001.wat"))
+        npt.assert_allclose(exp_waters, region[near], atol=1e-4)
+        npt.assert_equal(exp_frames, np.array([0, 0, 0, 1, 1])[near])
+        # without the flag nothing is written
+        os.remove("within5Aofligand.wat")
+        os.remove("cluster.000001.wat")
+        shutil.rmtree("entropy_output")
+        h, waters = small_site_analysis(data_dir)
+        h.calculate_site_quantities(energy=False, entropy=False, hbonds=False)
+        npt.assert_equal([os.path.exists(f) for f in ["within5Aofligand.wat", "cluster.000001.wat", "entropy_output"]],
+                         [False, False, False])
+    finally:
+        os.chdir(curr_dir)
+        shutil.rmtree(data_dir)
+
+
+def test_site_entropies_batch():
+    centers = [np.array([41.372, -27.915, 63.208]), np.array([12.5, 3.25, -7.75]), np.array([0.0, 0.0, 0.0])]
+    sizes = [3000, 200, 40]
+    std_waters, exp_waters, std_offsets, exp_offsets = [], [], [0], [0]
+    for i, (center, n_wat) in enumerate(zip(centers, sizes)):
+        waters = synthetic_site(center, n_wat, seed=i + 3)
+        dist = np.sqrt(((waters[:, 0, :] - center)**2).sum(axis=1))
+        std_waters.append(waters[dist <= 1.0])
+        exp_waters.append(waters)
+        std_offsets.append(std_offsets[-1] + std_waters[-1].shape[0])
+        exp_offsets.append(exp_offsets[-1] + n_wat)
+    # a site without waters
+    std_offsets.append(std_offsets[-1])
+    exp_offsets.append(exp_offsets[-1])
+
+    trans, orient, probable, seconds = ext1.run_site_entropies(np.concatenate(std_waters), std_offsets,
+                                                               np.concatenate(exp_waters), exp_offsets, n_threads=2)
+    npt.assert_equal(trans.shape, (4,))
+    npt.assert_equal(probable.shape, (4, 3, 3))
+    npt.assert_equal(seconds.shape, (4,))
+    for i in range(3):
+        site_trans, site_orient = ext1.run_site_entropy(std_waters[i], exp_waters[i])
+        npt.assert_almost_equal(trans[i], site_trans, decimal=10)
+        npt.assert_almost_equal(orient[i], site_orient, decimal=10)
+        # the probable configuration is one of the waters, moved onto one of the oxygens
+        oxygens = std_waters[i][:, 0, :]
+        npt.assert_(np.min(np.abs(oxygens - probable[i, 0]).max(axis=1)) < 1e-9)
+    npt.assert_(np.isnan(trans[3]) and np.isnan(orient[3]) and np.isnan(probable[3]).all())
+
+
+def test_site_entropy_per_water():
+    center = np.array([41.372, -27.915, 63.208])
+    waters = synthetic_site(center, 1500, seed=7)
+    dist = np.sqrt(((waters[:, 0, :] - center)**2).sum(axis=1))
+    std_waters = waters[dist <= 1.0]
+    psi = -0.5772156649 + np.concatenate([[0], np.cumsum(1.0 / np.arange(1, 3))])
+    for single in [0, 1]:
+        trans, orient, trans_dist, trans_log, orient_dist, orient_log = ext1.run_site_entropy(
+            std_waters, waters, single=single, kmax=3, per_water=1)
+        npt.assert_equal(trans_dist.shape, (std_waters.shape[0], 3))
+        # the entropies are the means of the per water log terms
+        npt.assert_almost_equal(8.314472 * 300. * 0.239 * (np.nanmean(trans_log, axis=0) - psi) / 1000, trans,
+                                decimal=10)
+        npt.assert_almost_equal(8.314472 * 300. * 0.239 * (np.nanmean(orient_log, axis=0) - psi) / 1000, orient,
+                                decimal=10)
+        # the translational distances are those to the nearest other oxygens of the expanded cluster
+        pair = np.sqrt(((std_waters[:, np.newaxis, 0, :] - waters[np.newaxis, :, 0, :])**2).sum(axis=2))
+        npt.assert_allclose(np.sort(pair, axis=1)[:, 1:4], trans_dist, rtol=1e-5 if single else 1e-12)
+    # the batch call gives the same rows for the waters of each site
+    result = ext1.run_site_entropies(np.concatenate([std_waters, std_waters]), [0, 0, std_waters.shape[0],
+                                     2 * std_waters.shape[0]], np.concatenate([waters, waters]),
+                                     [0, 0, waters.shape[0], 2 * waters.shape[0]], kmax=3, per_water=1)
+    npt.assert_equal(len(result), 8)
+    trans, orient, trans_dist, trans_log, orient_dist, orient_log = ext1.run_site_entropy(std_waters, waters, kmax=3,
+                                                                                          per_water=1)
+    for batch, site in zip(result[4:], [trans_dist, trans_log, orient_dist, orient_log]):
+        npt.assert_almost_equal(batch[:std_waters.shape[0]], site, decimal=10)
+        npt.assert_almost_equal(batch[std_waters.shape[0]:], site, decimal=10)
+
+
+def test_site_convergence():
+    n_frames, n_blocks = 97, 10
+    center = np.array([41.372, -27.915, 63.208])
+    waters = synthetic_site(center, 3000, seed=11)
+    frames = np.random.RandomState(11).randint(0, n_frames, waters.shape[0])
+    std = np.sqrt(((waters[:, 0, :] - center)**2).sum(axis=1)) <= 1.0
+    block_trans, block_orient, prefix_trans, prefix_orient = ext1.run_site_convergence(
+        waters[std], frames[std], [0, std.sum()], waters, frames, [0, waters.shape[0]], n_frames, n_blocks=n_blocks,
+        single=0)
+    npt.assert_equal(block_trans.shape, (1, n_blocks))
+    block = np.arange(n_frames) * n_blocks // n_frames
+    for j in range(n_blocks):
+        # each window is the entropy of its own waters, the density scaled to its share of the frames
+        for window, trans, orient in [(block == j, block_trans, block_orient),
+                                      (block <= j, prefix_trans, prefix_orient)]:
+            in_window = window[frames]
+            window_trans, window_orient = ext1.run_site_entropy(waters[std & in_window], waters[in_window], single=0)
+            window_trans += 8.314472 * 300. * 0.239 * np.log(window.sum() / float(n_frames)) / 1000
+            npt.assert_almost_equal(trans[0, j], window_trans, decimal=10)
+            npt.assert_almost_equal(orient[0, j], window_orient, decimal=10)
+    # the last prefix is the whole trajectory
+    trans, orient = ext1.run_site_entropy(waters[std], waters, single=0)
+    npt.assert_almost_equal(prefix_trans[0, -1], trans, decimal=12)
+    npt.assert_raises(ValueError, ext1.run_site_convergence, waters[std], frames[std] + n_frames, [0, std.sum()],
+                      waters, frames, [0, waters.shape[0]], n_frames)
+
+
+def test_six_dim_probable():
+    # the water written is the one nearest on average to its three nearest neighbours, by brute force over all pairs
+    # in the six dimensional metric: the oxygen distance and the angle of the rotation taking one water onto the other
+    data_dir = tempfile.mkdtemp()
+    curr_dir = os.getcwd()
+    try:
+        os.chdir(data_dir)
+        waters = synthetic_site(np.array([41.372, -27.915, 63.208]), 60, seed=3)
+        write_waters("cluster.000001.pdb", waters, header=True)
+        ext1.run_6dimprob("cluster.000001.pdb")
+        with open("probcenters.pdb") as f:
+            line = f.readline()
+        oxygen = np.array([float(line[30 + 8*i:38 + 8*i]) for i in range(3)])
+
+        h1, h2 = waters[:, 1] - waters[:, 0], waters[:, 2] - waters[:, 0]
+        frames = np.empty((len(waters), 3, 3))
+        frames[:, 0] = h1 + h2
+        frames[:, 2] = np.cross(h1, h2)
+        frames[:, 0] /= np.linalg.norm(frames[:, 0], axis=1)[:, None]
+        frames[:, 2] /= np.linalg.norm(frames[:, 2], axis=1)[:, None]
+        frames[:, 1] = np.cross(frames[:, 2], frames[:, 0])
+        trace = np.einsum("ikl,jkl->ij", frames, frames)
+        angle = np.arccos(np.clip((trace - 1)/2, -1, 1))
+        d = np.sqrt(((waters[:, None, 0] - waters[None, :, 0])**2).sum(axis=2) + angle**2)
+        np.fill_diagonal(d, np.inf)
+        mean3 = np.sort(d, axis=1)[:, :3].mean(axis=1)
+        # the angles of the rounded waters differ from the quaternions of the extension in the last digits
+        written = np.flatnonzero((np.abs(waters[:, 0] - oxygen) < 1e-6).all(axis=1))
+        npt.assert_equal(len(written), 1)
+        npt.assert_(mean3[written[0]] - mean3.min() < 1e-2)
+
+        open("empty.pdb", "w").close()
+        npt.assert_raises(RuntimeError, ext1.run_6dimprob, "empty.pdb")
+    finally:
+        os.chdir(curr_dir)
+        shutil.rmtree(data_dir)
+
+
+if __name__ == '__main__':
+    test_site_entropy_arrays()
+    test_site_entropy_pdb_records()
+    test_water_container()
+    test_export_clusters()
+    test_site_entropies_batch()
+    test_site_entropy_per_water()
+    test_site_convergence()
+    test_six_dim_probable()
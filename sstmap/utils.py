@@ -493,6 +493,72 @@ def write_watpdb_from_coords(filename, coords, full_water_res=False):
     
     """
 
+# header of the binary water container, the layout is described in pdbcoords.h
+WATER_CONTAINER_HEADER = np.dtype([("magic", "S8"), ("version", "<u4"), ("header_size", "<u4"),
+                                   ("n_waters", "<u8"), ("flags", "<u4"), ("reserved", "<u4")])
+
+
+def write_water_container(filename, waters, frames=None):
+    """Writes waters to the binary water container read by the entropy and clustering extensions in place of a PDB
+    file, with their coordinates as float32 and, optionally, the frame of every water.
+
+    Parameters
+    ----------
+    filename : str
+        Name of the file, used as given
+    waters : np.ndarray, float, shape(N_waters, 3, 3) or shape(3 * N_waters, 3)
+        O, H1 and H2 positions of every water, in angstrom
+    frames : np.ndarray, int, shape(N_waters), optional
+        Frame of every water, counted from the first frame analysed
+    """
+    waters = np.asarray(waters)
+    if waters.shape[-1:] != (3,) or not (waters.shape[1:] == (3, 3) or (waters.ndim == 2 and waters.shape[0] % 3 == 0)):
+        raise ValueError("waters must be of shape (N_waters, 3, 3) or (3 * N_waters, 3), got %s" % (waters.shape,))
+    waters = np.ascontiguousarray(waters.reshape(-1, 3, 3), dtype="<f4")
+    header = np.zeros(1, dtype=WATER_CONTAINER_HEADER)
+    header["magic"] = b"SSTWATER"
+    header["version"] = 1
+    header["header_size"] = WATER_CONTAINER_HEADER.itemsize
+    header["n_waters"] = waters.shape[0]
+    if frames is not None:
+        frames = np.asarray(frames).astype("<i4")
+        if frames.shape != (waters.shape[0],):
+            raise ValueError("One frame is needed for every water, got %s for %d waters."
+                             % (frames.shape, waters.shape[0]))
+        header["flags"] = 1
+    with open(filename, "wb") as f:
+        header.tofile(f)
+        waters.tofile(f)
+        if frames is not None:
+            frames.tofile(f)
+
+
+def read_water_container(filename):
+    """Reads a binary water container written by write_water_container or by the clustering extension.
+
+    Returns
+    -------
+    waters : np.ndarray, float32, shape(N_waters, 3, 3)
+        O, H1 and H2 positions of every water, memory-mapped read-only from the file
+    frames : np.ndarray, int32, shape(N_waters) or None
+        Frame of every water, None when the file has none
+    """
+    header = np.fromfile(filename, dtype=WATER_CONTAINER_HEADER, count=1)
+    if header.shape[0] != 1 or header["magic"][0] != b"SSTWATER" or header["version"][0] != 1:
+        raise ValueError("%s is not a water container" % filename)
+    n_waters, offset = int(header["n_waters"][0]), int(header["header_size"][0])
+    has_frames = bool(header["flags"][0] & 1)
+    if os.path.getsize(filename) != offset + n_waters * (36 + 4 * has_frames):
+        raise ValueError("%s: the length of the water container does not match its header" % filename)
+    if n_waters == 0:
+        return np.zeros((0, 3, 3), dtype=np.float32), np.zeros(0, dtype=np.int32) if has_frames else None
+    waters = np.memmap(filename, dtype="<f4", mode="r", offset=offset, shape=(n_waters, 3, 3))
+    frames = None
+    if has_frames:
+        frames = np.memmap(filename, dtype="<i4", mode="r", offset=offset + 36 * n_waters, shape=(n_waters,))
+    return waters, frames
+
+
 class GISTFields:
     data_titles = ['index', 'x', 'y', 'z',
                   'N_wat', 'g_O', 'g_H',
@@ -0,0 +1,214 @@
+/*
+ * File:   vptree.h
+ *
+ * Vantage point tree over water configurations, the oxygen position and the orientation quaternion of each water
+ * (x y z qw qx qy qz, 7 doubles a water). The distance between two waters is the six dimensional one of the GIST
+ * entropy,
+ *
+ *     d = sqrt(|x0 - x1|^2 + rR^2),   rR = 2 acos(q0.q1)
+ *
+ * rR is not a sum over coordinates, so kdtree cannot prune on it, but it is the geodesic distance between the
+ * two quaternions on the unit sphere and d is a metric: the tree only relies on the triangle inequality and finds
+ * the exact nearest neighbour. q and -q are the same rotation. With antipodal set the tree uses
+ * rR = 2 acos(|q0.q1|), the angle of the rotation taking one water onto the other (at most pi), which is still a
+ * metric; without it q and -q are 2 pi apart as in the brute force loops of _sstmap_ext.c.
+ *
+ * Every node is the first point of its range, the rest of the range is split at the median distance mu to it:
+ * the nearer half follows the vantage point, the farther half comes after it. The search visits the half the
+ * query falls in first and the other one only if the ball of the best distance so far crosses mu. Ranges of
+ * VPBUCKET points or fewer are leaves and are scanned.
+ *
+ * The header is plain C and builds as C++ as well. getNNTrEntropy in _sstmap_ext.c searches it for the nearest
+ * neighbour of every water on the grid, sixdimprob in _sstmap_entropy.cpp for the three nearest of every water of
+ * a site. All functions are static inline, each translation unit gets its own copy.
+ */
+
+#ifndef VPTREE_H
+#define VPTREE_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VPBUCKET
+#define VPBUCKET 8
+#endif
+
+typedef struct {
+    int n;
+    int antipodal;
+    double *conf; //the n configurations in tree order, 7 doubles each
+    int *index; //index[i] is the input index of the configuration stored at i
+    double *mu; //mu[i] is the splitting distance of the node whose vantage point is stored at i
+} vptree;
+
+static inline double vptree_dist(const double *a, const double *b, int antipodal) {
+    //six dimensional distance between two configurations
+    double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    double dot = a[3]*b[3] + a[4]*b[4] + a[5]*b[5] + a[6]*b[6];
+    double rR;
+    if (antipodal && dot < 0) dot = -dot;
+    //rounding can push the dot product of unit quaternions just past 1
+    if (dot > 1) dot = 1;
+    else if (dot < -1) dot = -1;
+    rR = 2*acos(dot);
+    return sqrt(dx*dx + dy*dy + dz*dz + rR*rR);
+}
+
+static inline void vptree_swap(vptree *t, double *d, int i, int j) {
+    double tmp[7], td = d[i];
+    int ti = t->index[i];
+    memcpy(tmp, &t->conf[7*i], sizeof(tmp));
+    memcpy(&t->conf[7*i], &t->conf[7*j], sizeof(tmp));
+    memcpy(&t->conf[7*j], tmp, sizeof(tmp));
+    t->index[i] = t->index[j];
+    t->index[j] = ti;
+    d[i] = d[j];
+    d[j] = td;
+}
+
+static inline void vptree_select(vptree *t, double *d, int lo, int hi, int k) {
+    //partial sort of the configurations lo..hi-1 on d so that d[k] is in place, smaller ones before it
+    int l = lo, r = hi - 1;
+    while (r > l) {
+        int i, j, m = (l + r)/2;
+        double piv;
+        //median of three pivot, moved to l
+        if (d[m] < d[l]) vptree_swap(t, d, m, l);
+        if (d[r] < d[l]) vptree_swap(t, d, r, l);
+        if (d[r] < d[m]) vptree_swap(t, d, r, m);
+        vptree_swap(t, d, l, m);
+        piv = d[l];
+        i = l;
+        j = r + 1;
+        for (;;) {
+            do i++; while (i <= r && d[i] < piv);
+            do j--; while (d[j] > piv);
+            if (j < i) break;
+            vptree_swap(t, d, i, j);
+        }
+        vptree_swap(t, d, l, j);
+        if (j >= k) r = j - 1;
+        if (j <= k) l = j + 1;
+    }
+}
+
+static inline void vptree_split(vptree *t, double *d, int lo, int hi) {
+    int i, mid;
+    while (hi - lo > VPBUCKET) {
+        const double *vp = &t->conf[7*lo];
+        for (i = lo + 1; i < hi; i++) d[i] = vptree_dist(vp, &t->conf[7*i], t->antipodal);
+        mid = lo + 1 + (hi - lo - 1)/2;
+        vptree_select(t, d, lo + 1, hi, mid);
+        t->mu[lo] = d[mid];
+        vptree_split(t, d, lo + 1, mid);
+        lo = mid;
+    }
+}
+
+static inline vptree *vptree_build(const double *conf, int n, int antipodal) {
+    /*
+        Builds the tree over the n configurations conf (7 doubles each, the quaternions of unit length). The input
+        is copied. Returns NULL when out of memory, free the tree with vptree_free.
+    */
+    int i;
+    double *d;
+    vptree *t = (vptree *)calloc(1, sizeof(vptree));
+    if (t == NULL) return NULL;
+    t->n = n;
+    t->antipodal = antipodal;
+    t->conf = (double *)malloc(7*(size_t)(n > 0 ? n : 1)*sizeof(double));
+    t->index = (int *)malloc((size_t)(n > 0 ? n : 1)*sizeof(int));
+    t->mu = (double *)calloc((size_t)(n > 0 ? n : 1), sizeof(double));
+    d = (double *)malloc((size_t)(n > 0 ? n : 1)*sizeof(double));
+    if (t->conf == NULL || t->index == NULL || t->mu == NULL || d == NULL) {
+        free(t->conf);
+        free(t->index);
+        free(t->mu);
+        free(t);
+        free(d);
+        return NULL;
+    }
+    if (n > 0) memcpy(t->conf, conf, 7*(size_t)n*sizeof(double));
+    for (i = 0; i < n; i++) t->index[i] = i;
+    vptree_split(t, d, 0, n);
+    free(d);
+    return t;
+}
+
+static inline void vptree_free(vptree *t) {
+    if (t == NULL) return;
+    free(t->conf);
+    free(t->index);
+    free(t->mu);
+    free(t);
+}
+
+static inline void vptree_keep(double dq, int i, int k, double *bestd, int *bestn) {
+    //inserts configuration i at distance dq into the k best so far, kept sorted nearest first
+    int j = k - 1;
+    if (!(dq < bestd[j])) return;
+    while (j > 0 && bestd[j - 1] > dq) {
+        bestd[j] = bestd[j - 1];
+        bestn[j] = bestn[j - 1];
+        j--;
+    }
+    bestd[j] = dq;
+    bestn[j] = i;
+}
+
+static inline void vptree_search(const vptree *t, int lo, int hi, const double *q, int self, int k, double *bestd,
+                          int *bestn) {
+    int i;
+    double dv, mu;
+    int mid;
+    if (hi - lo <= VPBUCKET) {
+        for (i = lo; i < hi; i++) {
+            if (t->index[i] == self) continue;
+            vptree_keep(vptree_dist(q, &t->conf[7*i], t->antipodal), t->index[i], k, bestd, bestn);
+        }
+        return;
+    }
+    dv = vptree_dist(q, &t->conf[7*lo], t->antipodal);
+    if (t->index[lo] != self) vptree_keep(dv, t->index[lo], k, bestd, bestn);
+    mu = t->mu[lo];
+    mid = lo + 1 + (hi - lo - 1)/2;
+    //by the triangle inequality nothing within mu of the vantage point is nearer than dv - mu, nothing beyond it
+    //nearer than mu - dv; bestd[k - 1] is the distance to beat
+    if (dv <= mu) {
+        vptree_search(t, lo + 1, mid, q, self, k, bestd, bestn);
+        if (dv + bestd[k - 1] >= mu) vptree_search(t, mid, hi, q, self, k, bestd, bestn);
+    }
+    else {
+        vptree_search(t, mid, hi, q, self, k, bestd, bestn);
+        if (dv - bestd[k - 1] <= mu) vptree_search(t, lo + 1, mid, q, self, k, bestd, bestn);
+    }
+}
+
+static inline void vptree_knearest(const vptree *t, const double *q, int self, int k, int *nrst, double *dist) {
+    /*
+        The k nearest configurations of the tree to q (7 doubles), nearest first: nrst gets their input indices,
+        dist their distances. self is the input index excluded from the search, -1 for none. Places past the
+        number of other points get -1 and HUGE_VAL.
+    */
+    int i;
+    for (i = 0; i < k; i++) {
+        dist[i] = HUGE_VAL;
+        nrst[i] = -1;
+    }
+    if (k > 0) vptree_search(t, 0, t->n, q, self, k, dist, nrst);
+}
+
+static inline double vptree_nearest(const vptree *t, const double *q, int self, int *nrst) {
+    /*
+        Distance to the nearest configuration of the tree from q (7 doubles), *nrst gets its input index. self is
+        the input index excluded from the search, -1 for none. Returns HUGE_VAL and -1 when there is no other point.
+    */
+    double best;
+    int nn;
+    vptree_knearest(t, q, self, 1, &nn, &best);
+    if (nrst != NULL) *nrst = nn;
+    return best;
+}
+
+#endif /* VPTREE_H */
@@ -0,0 +1,310 @@
+/*
+ * File:   waterorient.h
+ *
+ * Orientation of water molecules from the positions of their three atoms, O, H1 and H2 (9 doubles a water). The
+ * frame of a water has H1 along x and the HOH plane as the xy plane. Its orientation is the product e = q q2 of
+ * two rotations:
+ *
+ *     q    about H1 x X, taking H1 onto the x axis,
+ *     q2   about the x axis, taking the normal of the rotated HOH plane onto the z axis,
+ *
+ * as in the GIST action of cpptraj. waterorient writes the quaternions e and/or the Euler angles
+ * (sin(theta), phi, psi) taken from them. The orientational entropy trees work on the Euler angles, the six
+ * dimensional GIST entropy on the quaternions.
+ *
+ * Both half angle rotations are written with square roots instead of acos, cos and sin, so that the quaternions
+ * take adds, multiplies, divides and square roots only and are computed for 4 waters at a time with AVX2 or 2 with
+ * SSE2. The flavour is picked from what the CPU reports when the module is loaded, like the leaf kernels of
+ * kdtree_simd.h, and every flavour does the same operations in the same order, the quaternions are bit for bit the
+ * same whichever one runs. The Euler angles need atan2 and are taken one water at a time.
+ *
+ * The header is plain C and builds as C++ as well, for the GIST extension and the site based entropy code. All
+ * functions are static, each translation unit gets its own copy.
+ */
+
+#ifndef WATERORIENT_H
+#define WATERORIENT_H
+
+#include <math.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WATERORIENT_X86
+#include <immintrin.h>
+#endif
+
+//waters of the buffer quaternions go through when only the Euler angles are wanted
+#define WATERORIENT_CHUNK 256
+
+static void waterorient_scalar(const double *w, double *e) {
+    //quaternion e (w x y z) of the water w, the reference for the SIMD flavours below
+    double h1x = w[3] - w[0], h1y = w[4] - w[1], h1z = w[5] - w[2];
+    double h2x = w[6] - w[0], h2y = w[7] - w[1], h2z = w[8] - w[2];
+    double l1 = sqrt(h1x*h1x + h1y*h1y + h1z*h1z);
+    double l2 = sqrt(h2x*h2x + h2y*h2y + h2z*h2z);
+    double a0, a2, a3, na, m00, m01, m02, m10, m11, m12, m20, m21, m22;
+    double r1x, r1y, r2x, r2y, r2z, r1z, zx, zy, zz, nz, sign, b0, b1;
+    h1x = h1x/l1; h1y = h1y/l1; h1z = h1z/l1;
+    h2x = h2x/l2; h2y = h2y/l2; h2z = h2z/l2;
+    //q = (1 + h1.X, H1 x X) normalized, the x component is 0; H1 pointing along -x is turned about y
+    a0 = 1 + h1x; a2 = -h1z; a3 = h1y;
+    na = sqrt(a0*a0 + a2*a2 + a3*a3);
+    if (na == 0) {
+        a0 = 0; a2 = 1; a3 = 0; na = 1;
+    }
+    a0 = a0/na; a2 = a2/na; a3 = a3/na;
+    //the rotation matrix of q as the conversion applies it
+    m00 = a0*a0 - a2*a2 - a3*a3; m01 = 2*a0*a3; m02 = -2*a0*a2;
+    m10 = -2*a0*a3; m11 = a0*a0 + a2*a2 - a3*a3; m12 = 2*a2*a3;
+    m20 = 2*a0*a2; m21 = 2*a2*a3; m22 = a0*a0 - a2*a2 + a3*a3;
+    r1x = m00*h1x + m01*h1y + m02*h1z; r1y = m10*h1x + m11*h1y + m12*h1z; r1z = m20*h1x + m21*h1y + m22*h1z;
+    r2x = m00*h2x + m01*h2y + m02*h2z; r2y = m10*h2x + m11*h2y + m12*h2z; r2z = m20*h2x + m21*h2y + m22*h2z;
+    //normal of the rotated HOH plane and q2 about x taking it onto Z, in the direction of the sign test
+    zx = r1y*r2z - r1z*r2y; zy = r1z*r2x - r1x*r2z; zz = r1x*r2y - r1y*r2x;
+    nz = sqrt(zx*zx + zy*zy + zz*zz);
+    sign = zy*r1x - zx*r1y;
+    zz = zz/nz;
+    if (zz > 1) zz = 1;
+    if (zz < -1) zz = -1;
+    b0 = sqrt((1 + zz)*0.5);
+    b1 = sqrt((1 - zz)*0.5);
+    if (!(sign < 0)) b1 = -b1;
+    e[0] = a0*b0;
+    e[1] = a0*b1;
+    e[2] = a2*b0 + a3*b1;
+    e[3] = a3*b0 - a2*b1;
+}
+
+#ifdef WATERORIENT_X86
+__attribute__((target("avx2")))
+static __m256d waterorient_load_avx2(const double *w, int k) {
+    return _mm256_set_pd(w[27 + k], w[18 + k], w[9 + k], w[k]);
+}
+
+__attribute__((target("avx2")))
+static int waterorient_avx2(const double *w, int n, double *e) {
+    const __m256d one = _mm256_set1_pd(1), two = _mm256_set1_pd(2), mtwo = _mm256_set1_pd(-2);
+    const __m256d zero = _mm256_setzero_pd(), half = _mm256_set1_pd(0.5), mone = _mm256_set1_pd(-1);
+    const __m256d negz = _mm256_set1_pd(-0.0);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const double *wi = w + 9*i;
+        __m256d ox = waterorient_load_avx2(wi, 0), oy = waterorient_load_avx2(wi, 1), oz = waterorient_load_avx2(wi, 2);
+        __m256d h1x = _mm256_sub_pd(waterorient_load_avx2(wi, 3), ox);
+        __m256d h1y = _mm256_sub_pd(waterorient_load_avx2(wi, 4), oy);
+        __m256d h1z = _mm256_sub_pd(waterorient_load_avx2(wi, 5), oz);
+        __m256d h2x = _mm256_sub_pd(waterorient_load_avx2(wi, 6), ox);
+        __m256d h2y = _mm256_sub_pd(waterorient_load_avx2(wi, 7), oy);
+        __m256d h2z = _mm256_sub_pd(waterorient_load_avx2(wi, 8), oz);
+        __m256d l1 = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(h1x, h1x), _mm256_mul_pd(h1y, h1y)),
+                                                  _mm256_mul_pd(h1z, h1z)));
+        __m256d l2 = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(h2x, h2x), _mm256_mul_pd(h2y, h2y)),
+                                                  _mm256_mul_pd(h2z, h2z)));
+        h1x = _mm256_div_pd(h1x, l1); h1y = _mm256_div_pd(h1y, l1); h1z = _mm256_div_pd(h1z, l1);
+        h2x = _mm256_div_pd(h2x, l2); h2y = _mm256_div_pd(h2y, l2); h2z = _mm256_div_pd(h2z, l2);
+        __m256d a0 = _mm256_add_pd(one, h1x), a2 = _mm256_xor_pd(h1z, negz), a3 = h1y;
+        __m256d na = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a0, a0), _mm256_mul_pd(a2, a2)),
+                                                  _mm256_mul_pd(a3, a3)));
+        __m256d flip = _mm256_cmp_pd(na, zero, _CMP_EQ_OQ);
+        a0 = _mm256_blendv_pd(a0, zero, flip);
+        a2 = _mm256_blendv_pd(a2, one, flip);
+        a3 = _mm256_blendv_pd(a3, zero, flip);
+        na = _mm256_blendv_pd(na, one, flip);
+        a0 = _mm256_div_pd(a0, na); a2 = _mm256_div_pd(a2, na); a3 = _mm256_div_pd(a3, na);
+        __m256d a00 = _mm256_mul_pd(a0, a0), a22 = _mm256_mul_pd(a2, a2), a33 = _mm256_mul_pd(a3, a3);
+        __m256d m00 = _mm256_sub_pd(_mm256_sub_pd(a00, a22), a33);
+        __m256d m01 = _mm256_mul_pd(_mm256_mul_pd(two, a0), a3);
+        __m256d m02 = _mm256_mul_pd(_mm256_mul_pd(mtwo, a0), a2);
+        __m256d m10 = _mm256_mul_pd(_mm256_mul_pd(mtwo, a0), a3);
+        __m256d m11 = _mm256_sub_pd(_mm256_add_pd(a00, a22), a33);
+        __m256d m12 = _mm256_mul_pd(_mm256_mul_pd(two, a2), a3);
+        __m256d m20 = _mm256_mul_pd(_mm256_mul_pd(two, a0), a2);
+        __m256d m21 = m12;
+        __m256d m22 = _mm256_add_pd(_mm256_sub_pd(a00, a22), a33);
+#define WATERORIENT_ROT_AVX2(m0, m1, m2, x, y, z) \
+        _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m0, x), _mm256_mul_pd(m1, y)), _mm256_mul_pd(m2, z))
+        __m256d r1x = WATERORIENT_ROT_AVX2(m00, m01, m02, h1x, h1y, h1z);
+        __m256d r1y = WATERORIENT_ROT_AVX2(m10, m11, m12, h1x, h1y, h1z);
+        __m256d r1z = WATERORIENT_ROT_AVX2(m20, m21, m22, h1x, h1y, h1z);
+        __m256d r2x = WATERORIENT_ROT_AVX2(m00, m01, m02, h2x, h2y, h2z);
+        __m256d r2y = WATERORIENT_ROT_AVX2(m10, m11, m12, h2x, h2y, h2z);
+        __m256d r2z = WATERORIENT_ROT_AVX2(m20, m21, m22, h2x, h2y, h2z);
+#undef WATERORIENT_ROT_AVX2
+        __m256d zx = _mm256_sub_pd(_mm256_mul_pd(r1y, r2z), _mm256_mul_pd(r1z, r2y));
+        __m256d zy = _mm256_sub_pd(_mm256_mul_pd(r1z, r2x), _mm256_mul_pd(r1x, r2z));
+        __m256d zz = _mm256_sub_pd(_mm256_mul_pd(r1x, r2y), _mm256_mul_pd(r1y, r2x));
+        __m256d nz = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(zx, zx), _mm256_mul_pd(zy, zy)),
+                                                  _mm256_mul_pd(zz, zz)));
+        __m256d sign = _mm256_sub_pd(_mm256_mul_pd(zy, r1x), _mm256_mul_pd(zx, r1y));
+        zz = _mm256_div_pd(zz, nz);
+        zz = _mm256_blendv_pd(zz, one, _mm256_cmp_pd(zz, one, _CMP_GT_OQ));
+        zz = _mm256_blendv_pd(zz, mone, _mm256_cmp_pd(zz, mone, _CMP_LT_OQ));
+        __m256d b0 = _mm256_sqrt_pd(_mm256_mul_pd(_mm256_add_pd(one, zz), half));
+        __m256d b1 = _mm256_sqrt_pd(_mm256_mul_pd(_mm256_sub_pd(one, zz), half));
+        b1 = _mm256_xor_pd(b1, _mm256_andnot_pd(_mm256_cmp_pd(sign, zero, _CMP_LT_OQ), negz));
+        __m256d e0 = _mm256_mul_pd(a0, b0);
+        __m256d e1 = _mm256_mul_pd(a0, b1);
+        __m256d e2 = _mm256_add_pd(_mm256_mul_pd(a2, b0), _mm256_mul_pd(a3, b1));
+        __m256d e3 = _mm256_sub_pd(_mm256_mul_pd(a3, b0), _mm256_mul_pd(a2, b1));
+        //e0..e3 hold one component of 4 waters, transposed into the quaternions of the 4 waters
+        __m256d t0 = _mm256_unpacklo_pd(e0, e1), t1 = _mm256_unpackhi_pd(e0, e1);
+        __m256d t2 = _mm256_unpacklo_pd(e2, e3), t3 = _mm256_unpackhi_pd(e2, e3);
+        _mm256_storeu_pd(e + 4*i, _mm256_permute2f128_pd(t0, t2, 0x20));
+        _mm256_storeu_pd(e + 4*i + 4, _mm256_permute2f128_pd(t1, t3, 0x20));
+        _mm256_storeu_pd(e + 4*i + 8, _mm256_permute2f128_pd(t0, t2, 0x31));
+        _mm256_storeu_pd(e + 4*i + 12, _mm256_permute2f128_pd(t1, t3, 0x31));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static __m128d waterorient_select_sse2(__m128d a, __m128d b, __m128d mask) {
+    //b where mask is set, a elsewhere
+    return _mm_or_pd(_mm_and_pd(mask, b), _mm_andnot_pd(mask, a));
+}
+
+__attribute__((target("sse2")))
+static int waterorient_sse2(const double *w, int n, double *e) {
+    const __m128d one = _mm_set1_pd(1), two = _mm_set1_pd(2), mtwo = _mm_set1_pd(-2);
+    const __m128d zero = _mm_setzero_pd(), half = _mm_set1_pd(0.5), mone = _mm_set1_pd(-1);
+    const __m128d negz = _mm_set1_pd(-0.0);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        const double *wi = w + 9*i;
+        __m128d ox = _mm_set_pd(wi[9], wi[0]), oy = _mm_set_pd(wi[10], wi[1]), oz = _mm_set_pd(wi[11], wi[2]);
+        __m128d h1x = _mm_sub_pd(_mm_set_pd(wi[12], wi[3]), ox);
+        __m128d h1y = _mm_sub_pd(_mm_set_pd(wi[13], wi[4]), oy);
+        __m128d h1z = _mm_sub_pd(_mm_set_pd(wi[14], wi[5]), oz);
+        __m128d h2x = _mm_sub_pd(_mm_set_pd(wi[15], wi[6]), ox);
+        __m128d h2y = _mm_sub_pd(_mm_set_pd(wi[16], wi[7]), oy);
+        __m128d h2z = _mm_sub_pd(_mm_set_pd(wi[17], wi[8]), oz);
+        __m128d l1 = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(h1x, h1x), _mm_mul_pd(h1y, h1y)),
+                                            _mm_mul_pd(h1z, h1z)));
+        __m128d l2 = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(h2x, h2x), _mm_mul_pd(h2y, h2y)),
+                                            _mm_mul_pd(h2z, h2z)));
+        h1x = _mm_div_pd(h1x, l1); h1y = _mm_div_pd(h1y, l1); h1z = _mm_div_pd(h1z, l1);
+        h2x = _mm_div_pd(h2x, l2); h2y = _mm_div_pd(h2y, l2); h2z = _mm_div_pd(h2z, l2);
+        __m128d a0 = _mm_add_pd(one, h1x), a2 = _mm_xor_pd(h1z, negz), a3 = h1y;
+        __m128d na = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(a0, a0), _mm_mul_pd(a2, a2)), _mm_mul_pd(a3, a3)));
+        __m128d flip = _mm_cmpeq_pd(na, zero);
+        a0 = waterorient_select_sse2(a0, zero, flip);
+        a2 = waterorient_select_sse2(a2, one, flip);
+        a3 = waterorient_select_sse2(a3, zero, flip);
+        na = waterorient_select_sse2(na, one, flip);
+        a0 = _mm_div_pd(a0, na); a2 = _mm_div_pd(a2, na); a3 = _mm_div_pd(a3, na);
+        __m128d a00 = _mm_mul_pd(a0, a0), a22 = _mm_mul_pd(a2, a2), a33 = _mm_mul_pd(a3, a3);
+        __m128d m00 = _mm_sub_pd(_mm_sub_pd(a00, a22), a33);
+        __m128d m01 = _mm_mul_pd(_mm_mul_pd(two, a0), a3);
+        __m128d m02 = _mm_mul_pd(_mm_mul_pd(mtwo, a0), a2);
+        __m128d m10 = _mm_mul_pd(_mm_mul_pd(mtwo, a0), a3);
+        __m128d m11 = _mm_sub_pd(_mm_add_pd(a00, a22), a33);
+        __m128d m12 = _mm_mul_pd(_mm_mul_pd(two, a2), a3);
+        __m128d m20 = _mm_mul_pd(_mm_mul_pd(two, a0), a2);
+        __m128d m21 = m12;
+        __m128d m22 = _mm_add_pd(_mm_sub_pd(a00, a22), a33);
+#define WATERORIENT_ROT_SSE2(m0, m1, m2, x, y, z) \
+        _mm_add_pd(_mm_add_pd(_mm_mul_pd(m0, x), _mm_mul_pd(m1, y)), _mm_mul_pd(m2, z))
+        __m128d r1x = WATERORIENT_ROT_SSE2(m00, m01, m02, h1x, h1y, h1z);
+        __m128d r1y = WATERORIENT_ROT_SSE2(m10, m11, m12, h1x, h1y, h1z);
+        __m128d r1z = WATERORIENT_ROT_SSE2(m20, m21, m22, h1x, h1y, h1z);
+        __m128d r2x = WATERORIENT_ROT_SSE2(m00, m01, m02, h2x, h2y, h2z);
+        __m128d r2y = WATERORIENT_ROT_SSE2(m10, m11, m12, h2x, h2y, h2z);
+        __m128d r2z = WATERORIENT_ROT_SSE2(m20, m21, m22, h2x, h2y, h2z);
+#undef WATERORIENT_ROT_SSE2
+        __m128d zx = _mm_sub_pd(_mm_mul_pd(r1y, r2z), _mm_mul_pd(r1z, r2y));
+        __m128d zy = _mm_sub_pd(_mm_mul_pd(r1z, r2x), _mm_mul_pd(r1x, r2z));
+        __m128d zz = _mm_sub_pd(_mm_mul_pd(r1x, r2y), _mm_mul_pd(r1y, r2x));
+        __m128d nz = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(zx, zx), _mm_mul_pd(zy, zy)), _mm_mul_pd(zz, zz)));
+        __m128d sign = _mm_sub_pd(_mm_mul_pd(zy, r1x), _mm_mul_pd(zx, r1y));
+        zz = _mm_div_pd(zz, nz);
+        zz = waterorient_select_sse2(zz, one, _mm_cmpgt_pd(zz, one));
+        zz = waterorient_select_sse2(zz, mone, _mm_cmplt_pd(zz, mone));
+        __m128d b0 = _mm_sqrt_pd(_mm_mul_pd(_mm_add_pd(one, zz), half));
+        __m128d b1 = _mm_sqrt_pd(_mm_mul_pd(_mm_sub_pd(one, zz), half));
+        b1 = _mm_xor_pd(b1, _mm_andnot_pd(_mm_cmplt_pd(sign, zero), negz));
+        __m128d e0 = _mm_mul_pd(a0, b0);
+        __m128d e1 = _mm_mul_pd(a0, b1);
+        __m128d e2 = _mm_add_pd(_mm_mul_pd(a2, b0), _mm_mul_pd(a3, b1));
+        __m128d e3 = _mm_sub_pd(_mm_mul_pd(a3, b0), _mm_mul_pd(a2, b1));
+        _mm_storeu_pd(e + 4*i, _mm_unpacklo_pd(e0, e1));
+        _mm_storeu_pd(e + 4*i + 2, _mm_unpacklo_pd(e2, e3));
+        _mm_storeu_pd(e + 4*i + 4, _mm_unpackhi_pd(e0, e1));
+        _mm_storeu_pd(e + 4*i + 6, _mm_unpackhi_pd(e2, e3));
+    }
+    return i;
+}
+#endif
+
+enum { WATERORIENT_NONE = 0, WATERORIENT_SSE2 = 1, WATERORIENT_AVX2 = 2 };
+
+#ifdef WATERORIENT_X86
+static int waterorient_detect(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return WATERORIENT_AVX2;
+    if (__builtin_cpu_supports("sse2")) return WATERORIENT_SSE2;
+    return WATERORIENT_NONE;
+}
+
+//set once when the module is loaded, before any thread can call in; waterorient is used with the GIL released and
+//inside OpenMP loops, so the flavour is never written afterwards
+static int waterorient_level_ = WATERORIENT_NONE;
+
+__attribute__((constructor)) static void waterorient_init(void) {
+    waterorient_level_ = waterorient_detect();
+}
+#endif
+
+static void waterorient_quaternions(const double *waters, int n, double *quat) {
+    int i = 0;
+#ifdef WATERORIENT_X86
+    int level = waterorient_level_;
+    if (level == WATERORIENT_AVX2) i = waterorient_avx2(waters, n, quat);
+    else if (level == WATERORIENT_SSE2) i = waterorient_sse2(waters, n, quat);
+#endif
+    for (; i < n; i++) waterorient_scalar(waters + 9*i, quat + 4*i);
+}
+
+static void waterorient_euler(const double *quat, int n, double *euler) {
+    //Euler angles (sin(theta), phi, psi) of n quaternions, away from the poles of theta = +-pi/2
+    int i;
+    for (i = 0; i < n; i++) {
+        const double *e = quat + 4*i;
+        double *a = euler + 3*i;
+        double singtest = e[1]*e[2] + e[3]*e[0];
+        if (singtest > 0.4999) {
+            a[0] = 1;
+            a[1] = 0;
+            a[2] = 2*atan2(e[1], e[0]);
+        }
+        else if (singtest < -0.4999) {
+            a[0] = -1;
+            a[1] = 0;
+            a[2] = -2*atan2(e[1], e[0]);
+        }
+        else {
+            a[0] = 2*singtest;
+            a[1] = atan2(2*e[1]*e[0] - 2*e[2]*e[3], 1 - 2*e[1]*e[1] - 2*e[3]*e[3]);
+            a[2] = atan2(2*e[2]*e[0] - 2*e[1]*e[3], 1 - 2*e[2]*e[2] - 2*e[3]*e[3]);
+        }
+    }
+}
+
+static void waterorient(const double *waters, int n, double *quat, double *euler) {
+    /*
+        Orientations of the n waters (O, H1, H2 positions, 9 doubles a water): quat receives 4 doubles a water
+        (w x y z), euler 3 (sin(theta), phi, psi). Either may be NULL.
+    */
+    int i;
+    if (quat != NULL) {
+        waterorient_quaternions(waters, n, quat);
+        if (euler != NULL) waterorient_euler(quat, n, euler);
+        return;
+    }
+    if (euler == NULL) return;
+    for (i = 0; i < n; i += WATERORIENT_CHUNK) {
+        double buf[4*WATERORIENT_CHUNK];
+        int m = n - i < WATERORIENT_CHUNK ? n - i : WATERORIENT_CHUNK;
+        waterorient_quaternions(waters + 9*i, m, buf);
+        waterorient_euler(buf, m, euler + 3*i);
+    }
+}
+
+#endif /* WATERORIENT_H */